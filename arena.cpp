@@ -0,0 +1,19 @@
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+#include "arena.h"
+
+arena_t::~arena_t() {
+    for (char* b : blocks) free(b);
+}
+
+void arena_t::grow(size_t size) {
+    const size_t block = std::max(size, std::min(MAX_BLOCK, std::max(FIRST_BLOCK, total)));
+    char* b = (char*)malloc(block);
+    if (!b) throw std::bad_alloc();
+    blocks.push_back(b);
+    total += block;
+    next = b;
+    end = b + block;
+}
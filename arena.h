@@ -0,0 +1,74 @@
+#ifndef included_arena_h_
+#define included_arena_h_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * Bump allocator for the data of a document. Allocating moves a pointer forward in the current
+ * block, and nothing is ever freed on its own: the blocks, which double in size as they fill up,
+ * are released all at once along with the arena. Objects placed in an arena are never destroyed,
+ * so they must not own anything that lives elsewhere; the text values point to is kept in the
+ * pools of the arena instead. An arena is not thread safe; it is only ever allocated from by one
+ * thread at a time.
+ */
+class arena_t {
+public:
+    arena_t() {}
+    arena_t(const arena_t&) = delete;
+    arena_t& operator=(const arena_t&) = delete;
+    ~arena_t();
+    void* allocate(size_t size) {
+        size = (size + ALIGN - 1) & ~(ALIGN - 1);
+        if (size > size_t(end - next)) grow(size);
+        void* p = next;
+        next += size;
+        return p;
+    }
+    // construct a T in the arena, which is never destroyed
+    template<typename T, typename... Args> T* make(Args&&... args) {
+        static_assert(alignof(T) <= ALIGN, "over-aligned type");
+        return new (allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+    // the alignment of everything allocated; that of pointers, which is all entries need
+    static const size_t ALIGN = alignof(void*);
+    // the pools of the text of the values made in the arena (see val_t), freed along with it
+    std::shared_ptr<void> pools;
+private:
+    static const size_t FIRST_BLOCK = size_t(1) << 16;
+    static const size_t MAX_BLOCK = size_t(1) << 24;
+    std::vector<char*> blocks;
+    char* next{nullptr};
+    char* end{nullptr};
+    size_t total{0}; // bytes in all blocks
+    // start a block with room for at least size bytes
+    void grow(size_t size);
+};
+
+/**
+ * Allocator taking memory from an arena, or from the heap if it has none. Containers copied or
+ * assigned from others take on their arena, so that entries copied between documents stay in the
+ * arena of the document they were made in.
+ */
+template<typename T> struct arena_allocator {
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_copy_assignment;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+    arena_t* arena{nullptr};
+    arena_allocator(arena_t* arena_in = nullptr) : arena(arena_in) {}
+    template<typename U> arena_allocator(const arena_allocator<U>& other) : arena(other.arena) {}
+    static_assert(alignof(T) <= arena_t::ALIGN, "over-aligned type");
+    T* allocate(size_t n) { return (T*)(arena ? arena->allocate(n * sizeof(T)) : ::operator new(n * sizeof(T))); }
+    void deallocate(T* p, size_t) { if (!arena) ::operator delete(p); }
+};
+
+template<typename T, typename U> inline bool operator==(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.arena == b.arena; }
+template<typename T, typename U> inline bool operator!=(const arena_allocator<T>& a, const arena_allocator<U>& b) { return a.arena != b.arena; }
+
+#endif // included_arena_h_
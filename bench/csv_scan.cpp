@@ -0,0 +1,113 @@
+// CSV reading throughput benchmark.
+//
+// Compile:
+//   g++ -O3 -std=c++11 -pthread bench/csv_scan.cpp parser/*.cpp -lz -o bench_csv_scan
+//
+// Run with a CSV file as argument, or without arguments to generate a synthetic CSSE-style file.
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../parser/csv.h"
+#include "../parser/scan.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+static std::string generate(size_t target_bytes) {
+    char path[] = "/tmp/csvman-bench-XXXXXX";
+    int fd = mkstemp(path);
+    if (fd < 0) { perror("mkstemp"); exit(1); }
+    FILE* fp = fdopen(fd, "w");
+    fprintf(fp, "Province/State,Country/Region,Lat,Long");
+    for (int d = 0; d < 400; ++d) fprintf(fp, ",%d/%d/%d", 1 + d / 28 % 12, 1 + d % 28, 20 + d / 336);
+    fputc('\n', fp);
+    size_t written = 0;
+    for (unsigned row = 0; written < target_bytes; ++row) {
+        written += fprintf(fp, "%s,\"Region %u, Subregion\",%u.%u,-%u.%u", row % 3 ? "" : "Province", row, row % 90, row % 7, row % 180, row % 11);
+        unsigned v = row % 97;
+        for (int d = 0; d < 400; ++d) written += fprintf(fp, ",%u", v += d % 5);
+        fputc('\n', fp);
+        ++written;
+    }
+    fclose(fp);
+    return path;
+}
+
+static void report(const char* name, size_t bytes, size_t rows, bench_clock::time_point start) {
+    double secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+    printf("%-28s %8.3f s %8.3f GB/s (%zu rows)\n", name, secs, bytes / secs / 1e9, rows);
+}
+
+int main(int argc, char** argv) {
+    std::string path;
+    bool generated = argc < 2;
+    path = generated ? generate(512 << 20) : argv[1];
+
+    struct stat st;
+    if (stat(path.c_str(), &st)) { perror(path.c_str()); return 1; }
+    size_t size = st.st_size;
+    printf("%s: %zu bytes, kernel %s\n", path.c_str(), size, csv_scan::kernel_name());
+
+    int fd = open(path.c_str(), O_RDONLY);
+    const char* base = (const char*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (base == MAP_FAILED) { perror("mmap"); return 1; }
+
+    {
+        // scalar byte loop over the mapped file
+        auto start = bench_clock::now();
+        csv_row_t row;
+        size_t rows = 0;
+        for (const char* pos = base; pos < base + size; ++rows) pos = csv_parse_row(pos, base + size, row);
+        report("csv_parse_row (scalar)", size, rows, start);
+    }
+
+    {
+        // structural scanning alone
+        auto start = bench_clock::now();
+        csv_scan::scanner_t scanner;
+        std::vector<uint64_t> index;
+        size_t rows = 0;
+        for (size_t at = 0; at < size; at += 256 << 10) {
+            size_t len = size - at < (256 << 10) ? size - at : 256 << 10;
+            index.clear();
+            scanner.scan(base + at, len, at, index);
+            for (uint64_t e : index) rows += e & csv_scan::newline_flag;
+        }
+        report("scanner_t::scan", size, rows, start);
+    }
+
+    munmap((void*)base, size);
+    close(fd);
+
+    {
+        // full reader, as used by document_t
+        auto start = bench_clock::now();
+        std::unique_ptr<csv_reader> reader = csv_reader::open(fopen(path.c_str(), "r"));
+        csv_row_t row;
+        size_t rows = 0;
+        while (reader->read(row)) ++rows;
+        report("mmap_csv::read", size, rows, start);
+    }
+
+    {
+        // read-ahead reader, as used with --io=read
+        auto start = bench_clock::now();
+        std::unique_ptr<csv_reader> reader = csv_reader::open(fopen(path.c_str(), "r"), 1, io_mode::read);
+        csv_row_t row;
+        size_t rows = 0;
+        while (reader->read(row)) ++rows;
+        report("stream_csv::read (read)", size, rows, start);
+        queue_stats_t stats;
+        if (reader->io_stats(stats)) printf("%28s %8.3f s waiting for input over %zu chunks\n", "", stats.consumer_wait_ns / 1e9, stats.chunks);
+    }
+
+    if (generated) unlink(path.c_str());
+}
@@ -0,0 +1,88 @@
+// Numeric cell validation and conversion benchmark.
+//
+// Compile:
+//   g++ -O3 -std=c++11 bench/number_parse.cpp parser/number.cpp -o bench_number_parse
+//
+// Run without arguments; cells are generated to resemble those of the CSSE and GDS formats
+// (counts, coordinates, dates and names).
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../utils.h"
+#include "../parser/number.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+static std::vector<std::string> generate(size_t count) {
+    static const char* names[] = { "Afghanistan", "", "Korea, South", "New South Wales", "Diamond Princess" };
+    std::vector<std::string> cells;
+    cells.reserve(count);
+    unsigned seed = 1;
+    auto next = [&]() { seed = seed * 1103515245 + 12345; return seed >> 8; };
+    char buf[32];
+    for (size_t i = 0; i < count; ++i) {
+        unsigned r = next();
+        switch (r % 16) {
+        case 0: snprintf(buf, sizeof(buf), "%u.%u", next() % 90, next()); break;
+        case 1: snprintf(buf, sizeof(buf), "2020-%02u-%02u", 1 + next() % 12, 1 + next() % 28); break;
+        case 2: snprintf(buf, sizeof(buf), "%s", names[next() % 5]); break;
+        case 3: snprintf(buf, sizeof(buf), "%u%09u", next(), next() % 1000000000); break;
+        default: snprintf(buf, sizeof(buf), "%u", next() % (r % 2 ? 100 : 1000000)); break;
+        }
+        cells.push_back(buf);
+    }
+    return cells;
+}
+
+static void report(const char* name, size_t cells, size_t numeric, int64_t sum, bench_clock::time_point start) {
+    double secs = std::chrono::duration<double>(bench_clock::now() - start).count();
+    printf("%-32s %8.3f s %8.1f M cells/s (%zu numeric, sum %lld)\n", name, secs, cells / secs / 1e6, numeric, (long long)sum);
+}
+
+int main(int argc, char** argv) {
+    const size_t count = 1 << 22, rounds = 8;
+    std::vector<std::string> cells = generate(count);
+
+    {
+        // is_numeric() followed by atoll(), as values used to be imprinted
+        auto start = bench_clock::now();
+        size_t numeric = 0;
+        int64_t sum = 0;
+        for (size_t r = 0; r < rounds; ++r) {
+            for (const auto& c : cells) {
+                if (!is_numeric(c.c_str())) continue;
+                ++numeric;
+                sum += atoll(c.c_str());
+            }
+        }
+        report("is_numeric + atoll", count * rounds, numeric, sum, start);
+    }
+
+    {
+        // validation alone, as before
+        auto start = bench_clock::now();
+        size_t numeric = 0;
+        for (size_t r = 0; r < rounds; ++r) {
+            for (const auto& c : cells) numeric += is_numeric(c.c_str());
+        }
+        report("is_numeric", count * rounds, numeric, 0, start);
+    }
+
+    {
+        auto start = bench_clock::now();
+        size_t numeric = 0;
+        int64_t sum = 0, v;
+        for (size_t r = 0; r < rounds; ++r) {
+            for (const auto& c : cells) {
+                if (!number::parse(c.data(), c.size(), v)) continue;
+                ++numeric;
+                sum += v;
+            }
+        }
+        report("number::parse", count * rounds, numeric, sum, start);
+    }
+}
@@ -0,0 +1,147 @@
+#include <set>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "env.h"
+#include "cache.h"
+
+bool hasher_t::add_file(const std::string& path) {
+    FILE* fp = fopen(path.c_str(), "r");
+    if (!fp) return false;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) add(buf, n);
+    fclose(fp);
+    return true;
+}
+
+bool hasher_t::add_range(const std::string& path, uint64_t begin, uint64_t end) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return false;
+    posix_fadvise(fd, begin, end - begin, POSIX_FADV_SEQUENTIAL);
+    char buf[65536];
+    while (begin < end) {
+        size_t want = end - begin < sizeof(buf) ? end - begin : sizeof(buf);
+        ssize_t n = pread(fd, buf, want, begin);
+        if (n <= 0) break;
+        add(buf, n);
+        begin += n;
+    }
+    close(fd);
+    return begin == end;
+}
+
+bool hasher_t::add_identity(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st)) return false;
+    char* real = realpath(path.c_str(), nullptr);
+    add(real ? std::string(real) : path);
+    free(real);
+    add_u64(st.st_dev);
+    add_u64(st.st_ino);
+    add_u64(st.st_size);
+    add_u64(st.st_mtim.tv_sec);
+    add_u64(st.st_mtim.tv_nsec);
+    return true;
+}
+
+void snapshot_writer_t::value(const val_t* vp) {
+    u8(vp != nullptr);
+    if (!vp) return;
+    const val_t& v = *vp;
+    const comps_t& comps = v.get_comps();
+    // the text of numbers is made from the number
+    str(v.numeric ? std::string() : *v.text());
+    u32(comps.size());
+    for (size_t i = 0; i < comps.size(); ++i) {
+        size_t len;
+        const char* text = comps.component(i, len);
+        str(comps.layout->names[i]);
+        str(std::string(text, len));
+        u32(comps.layout->rank[i]);
+    }
+    u64(v.get_number());
+    u8(v.numeric);
+    u32(v.get_alternatives().size());
+    for (const auto& a : v.get_alternatives()) str(a);
+    u32(v.phase);
+}
+
+bool snapshot_writer_t::save(const std::string& path) const {
+    std::string tmp = path + ".tmp";
+    FILE* fp = fopen(tmp.c_str(), "w");
+    if (!fp) return false;
+    bool ok = fwrite(buf.data(), 1, buf.size(), fp) == buf.size();
+    ok = (0 == fclose(fp)) && ok;
+    if (ok) ok = 0 == rename(tmp.c_str(), path.c_str());
+    if (!ok) unlink(tmp.c_str());
+    return ok;
+}
+
+snapshot_reader_t::snapshot_reader_t(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) return;
+    struct stat st;
+    if (0 == fstat(fd, &st) && st.st_size > 0) {
+        void* m = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (m != MAP_FAILED) {
+            base = (char*)m;
+            size = st.st_size;
+            madvise(base, size, MADV_SEQUENTIAL);
+        }
+    }
+    close(fd);
+}
+
+snapshot_reader_t::~snapshot_reader_t() {
+    if (base) munmap(base, size);
+}
+
+void snapshot_reader_t::take(void* dst, size_t len) {
+    if (size - pos < len) throw std::runtime_error("truncated snapshot");
+    memcpy(dst, base + pos, len);
+    pos += len;
+}
+
+std::string snapshot_reader_t::str() {
+    uint32_t len = u32();
+    if (size - pos < len) throw std::runtime_error("truncated snapshot");
+    std::string s(base + pos, len);
+    pos += len;
+    return s;
+}
+
+Value snapshot_reader_t::value(arena_t* arena) {
+    if (!u8()) return nullptr;
+    mutable_val_t mv;
+    mv.value = str();
+    const uint32_t ncomps = u32();
+    if (ncomps > layout_t::MAX_COMPONENTS) throw std::runtime_error("too many components");
+    if (ncomps > 0) {
+        std::vector<prioritized_t> varnames;
+        std::string scanned;
+        size_t lengths[layout_t::MAX_COMPONENTS];
+        for (uint32_t i = 0; i < ncomps; ++i) {
+            std::string name = str();
+            std::string text = str();
+            varnames.emplace_back(name, int(u32()));
+            lengths[i] = text.size();
+            scanned += text;
+        }
+        mv.comps.pack(layout_t::of(varnames), scanned.data(), lengths);
+    }
+    mv.number = u64();
+    mv.numeric = u8();
+    mv.alternatives.resize(u32());
+    for (auto& a : mv.alternatives) a = str();
+    Value v = make_value(arena, mv);
+    v->phase = u32();
+    return v;
+}
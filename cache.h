@@ -0,0 +1,74 @@
+#ifndef included_cache_h_
+#define included_cache_h_
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+class val_t;
+class arena_t;
+typedef std::shared_ptr<val_t> Value;
+
+/**
+ * 64-bit FNV-1a hash, used to key snapshots on the formula, the input files and the state they
+ * were loaded in.
+ */
+struct hasher_t {
+    uint64_t h{14695981039346656037ULL};
+    void add(const void* data, size_t len) {
+        const uint8_t* p = (const uint8_t*)data;
+        for (size_t i = 0; i < len; ++i) h = (h ^ p[i]) * 1099511628211ULL;
+    }
+    void add(const std::string& s) { add_u64(s.size()); add(s.data(), s.size()); }
+    void add_u64(uint64_t v) { add(&v, sizeof(v)); }
+    // add the contents of the file at path; false if it cannot be read
+    bool add_file(const std::string& path);
+    // add bytes [begin, end) of the file at path; false if it cannot be read or is shorter than end
+    bool add_range(const std::string& path, uint64_t begin, uint64_t end);
+    // add the identity of the file at path (location, inode, size, modification time); false if it cannot be stat'ed
+    bool add_identity(const std::string& path);
+};
+
+/**
+ * Append-only binary encoding of a snapshot. Integers are stored in native byte order, as
+ * snapshots are only ever read back on the machine that wrote them.
+ */
+class snapshot_writer_t {
+public:
+    std::string buf;
+    void u8(uint8_t v) { buf.push_back(char(v)); }
+    void u32(uint32_t v) { buf.append((const char*)&v, sizeof(v)); }
+    void u64(uint64_t v) { buf.append((const char*)&v, sizeof(v)); }
+    void str(const std::string& s) { u32(s.size()); buf.append(s); }
+    // a value, which may be null
+    void value(const val_t* v);
+    // write the snapshot to path, replacing any previous one atomically
+    bool save(const std::string& path) const;
+};
+
+/**
+ * Reader for a snapshot written by snapshot_writer_t. The snapshot file is memory mapped for the
+ * lifetime of the reader. Reading past the end, or a malformed snapshot, throws.
+ */
+class snapshot_reader_t {
+public:
+    // map the snapshot at path; ok() is false if there is none
+    snapshot_reader_t(const std::string& path);
+    ~snapshot_reader_t();
+    bool ok() const { return base != nullptr; }
+    uint8_t u8() { uint8_t v; take(&v, sizeof(v)); return v; }
+    uint32_t u32() { uint32_t v; take(&v, sizeof(v)); return v; }
+    uint64_t u64() { uint64_t v; take(&v, sizeof(v)); return v; }
+    std::string str();
+    // a value, which may be null, made in arena if there is one
+    Value value(arena_t* arena = nullptr);
+    bool at_end() const { return pos == size; }
+private:
+    char* base{nullptr};
+    size_t size{0};
+    size_t pos{0};
+    void take(void* dst, size_t len);
+};
+
+#endif // included_cache_h_
@@ -1,9 +1,11 @@
+#include <algorithm>
 #include <stdexcept>
 #include <cstdio>
 
 #include "document.h"
 #include "parser/csv.h"
 #include "utils.h"
+#include "intern.h"
 
 int fake_argc = 10;
 const char * fake_argv[] = {
@@ -19,6 +21,13 @@ const char * fake_argv[] = {
     "res.csv"
 };
 
+// report the text interned by the values of a run: that of a document, and that of the values
+// made outside of arenas
+static void print_interned(string_pool_t::stats_t pool) {
+    pool += val_t::interned(nullptr);
+    printf("Interned %zu strings as %zu distinct ones (%zu bytes), saving %zu bytes\n", pool.requests, pool.distinct, pool.bytes, pool.saved);
+}
+
 int main(int argc, char* const* argv) {
     // #define argc fake_argc
     // #define argv fake_argv
@@ -35,6 +44,11 @@ int main(int argc, char* const* argv) {
     ca.add_option("help", 'h', no_arg);
     ca.add_option("verbose", 'v', no_arg);
     ca.add_option("debug", 'D', req_arg);
+    ca.add_option("jobs", 'j', req_arg);
+    ca.add_option("io", 'i', req_arg);
+    ca.add_option("stream", 's', no_arg);
+    ca.add_option("cache", 'c', req_arg);
+    ca.add_option("shards", 'S', no_arg);
     ca.parse(argc, argv);
     if (ca.m.count('h') || ca.l.size() < 2) {
         fprintf(stderr, "Syntax: %s [--mode=<mode>|-m<mode> [--param=<param>|-p<param>]] <cmf file> <csv file*> [<cmf file 2> <csv file 2*> [...]] [-f <cmf file> <csv base filename>]\n", argv[0]);
@@ -43,6 +57,13 @@ int main(int argc, char* const* argv) {
         fprintf(stderr, "For 2 documents, the first is the source, and the second is the destination (going into the third, -o CSV file).\n");
         fprintf(stderr, "For 3 or more documents, all documents except the last one are considered sources, and the last document is the destination.\n");
         fprintf(stderr, "Inputs are never overwritten, unless they are specifically given as the output using -o.\n");
+        fprintf(stderr, "Large inputs can be parsed, and multiple inputs loaded, using multiple threads with --jobs=<n> or -j<n>; the result is identical to a single threaded run.\n");
+        fprintf(stderr, "A <csv file> may be - for stdin, and the output <csv base filename> may be - for stdout (log output then goes to stderr).\n");
+        fprintf(stderr, "With --stream or -s, a replace conversion writes each row as soon as it is read, in input order, using constant memory (other than for the distinct values of fit vars); this requires formats without sum(), trailing vars or aspects.\n");
+        fprintf(stderr, "With --cache=<dir> or -c<dir>, loaded documents are snapshotted in <dir>, and later runs restore unchanged inputs from there instead of parsing them.\n");
+        fprintf(stderr, "With --jobs, large outputs are also formatted using multiple threads; with --shards or -S, the output is instead written as one numbered file per job (e.g. 'name.000.csv').\n");
+        fprintf(stderr, "A <csv file> may also be a directory, in which case all CSV files inside it are read, in name order.\n");
+        fprintf(stderr, "Uncompressed inputs are memory mapped by default; --io=read or -iread reads them ahead on a background thread instead, and --io=direct does so bypassing the page cache (O_DIRECT).\n");
         fprintf(stderr, "Modes:\n");
         fprintf(stderr, "  replace          Rewrite a single document using a different format\n");
         fprintf(stderr, "  merge-source     Replace all values in destination which also exist in source(s), keeping only distinct values.\n");
@@ -62,6 +83,19 @@ int main(int argc, char* const* argv) {
         param = ca.m['p'];
     }
 
+    size_t jobs = 1;
+    if (ca.m.count('j')) {
+        jobs = std::max(1, atoi(ca.m['j'].c_str()));
+    }
+    io_mode io = io_mode::mmap;
+    if (ca.m.count('i')) {
+        io = parse_io_mode(ca.m['i']);
+    }
+    std::string cache_dir;
+    if (ca.m.count('c')) {
+        cache_dir = ca.m['c'];
+    }
+
     std::set<std::string> fitness_set;
 
     size_t source_end = ca.l.size();
@@ -70,22 +104,49 @@ int main(int argc, char* const* argv) {
     if (ca.m.count('f')) {
         // file output, with format specified in 'o' and the file as the last argument in 'l'.
         --source_end;
-        dest = std::make_shared<document_t>(ca.m.at('f').c_str(), &fitness_set);
         output_path = ca.l.back();
+        if (output_path == "-") claim_stdout();
+        dest = std::make_shared<document_t>(ca.m.at('f').c_str(), &fitness_set);
     }
 
     std::vector<Document> sources;
 
+    if (ca.m.count('s')) {
+        // streaming: a single source is converted row by row, without ever being loaded as a whole
+        if (mode != import_mode::replace) throw std::runtime_error("streaming requires replace mode (-m replace)");
+        sources.push_back(std::make_shared<document_t>(ca.next(), &fitness_set));
+        sources.back()->jobs = jobs;
+        sources.back()->io = io;
+        // the arguments are checked before anything is written
+        const std::vector<std::string> paths = sources.back()->input_paths(ca);
+        if (ca.iter < source_end) throw std::runtime_error("streaming only supports a single source document");
+        if (!dest) {
+            dest = std::make_shared<document_t>(sources.back()->cmf_path.c_str(), &fitness_set);
+        }
+        dest->stream_from_disk(*sources.back(), paths, output_path);
+        print_interned(sources.back()->interned());
+        return 0;
+    }
+
+    std::vector<std::vector<std::string>> inputs;
     while (ca.iter < source_end) {
         sources.push_back(std::make_shared<document_t>(ca.next(), &fitness_set));
-        sources.back()->load_from_disk(ca);
+        sources.back()->jobs = jobs;
+        sources.back()->io = io;
+        sources.back()->cache_dir = cache_dir;
+        inputs.push_back(sources.back()->input_paths(ca));
     }
+    document_t::load_from_disk(sources, inputs);
 
     if (!dest) {
         dest = std::make_shared<document_t>(sources.back()->cmf_path.c_str(), &fitness_set);
     }
 
+    dest->jobs = jobs;
+    dest->shards = ca.m.count('S') > 0;
     dest->import_data(sources, mode, param);
 
     dest->save_data_to_disk(output_path);
+
+    print_interned(dest->interned());
 }
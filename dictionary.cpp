@@ -0,0 +1,55 @@
+#include <stdexcept>
+
+#include "dictionary.h"
+
+uint32_t key_dictionary_t::encode(const val_t& v) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = codes.lower_bound(v);
+    if (it != codes.end() && !(v < it->first)) return it->second;
+    if (count == UINT32_MAX - 1) throw std::runtime_error("too many distinct keys");
+
+    const uint32_t code = count;
+    const uint64_t at = uint64_t(code) + (1 << FIRST_CHUNK_BITS);
+    const size_t bit = 63 - __builtin_clzll(at);
+    auto& chunk = chunks[bit - FIRST_CHUNK_BITS];
+    if (!chunk.load(std::memory_order_relaxed)) chunk.store(new std::atomic<uint64_t>[size_t(1) << bit], std::memory_order_release);
+
+    // the ranks of the neighbors, or the ends of the range
+    auto prev = it;
+    if (it != codes.begin()) --prev;
+    auto neighbors = [&](uint64_t& lo, uint64_t& hi) {
+        lo = it == codes.begin() ? 0 : rank(prev->second).load(std::memory_order_relaxed);
+        hi = it == codes.end() ? UINT64_MAX : rank(it->second).load(std::memory_order_relaxed);
+    };
+    uint64_t lo, hi;
+    neighbors(lo, hi);
+    if (hi - lo < 2) {
+        rerank();
+        neighbors(lo, hi);
+    }
+    // values usually come in order, so there is room at the ends for as many as possible
+    const uint64_t gap = hi - lo;
+    const uint64_t r = it == codes.end() && gap > SPACING ? lo + SPACING : it == codes.begin() && gap > SPACING ? hi - SPACING : lo + gap / 2;
+    rank(code).store(r, std::memory_order_relaxed);
+    codes.emplace_hint(it, v, code);
+    ++count;
+    return code;
+}
+
+void key_dictionary_t::rerank() {
+    const uint32_t v = version.load(std::memory_order_relaxed);
+    version.store(v + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    uint64_t r = 0;
+    for (const auto& c : codes) rank(c.second).store(r += SPACING, std::memory_order_relaxed);
+    version.store(v + 2, std::memory_order_release);
+}
+
+uint32_t key_encoder_t::encode(size_t column, const val_t& v) {
+    if (column >= known.size()) throw std::runtime_error("too many keys (" + std::to_string(column + 1) + " > " + std::to_string(known.size()) + ")");
+    auto it = known[column].find(v.identity());
+    if (it != known[column].end()) return it->second;
+    const uint32_t code = dictionaries[column].encode(v);
+    known[column].emplace(v.identity(), code);
+    return code;
+}
@@ -0,0 +1,85 @@
+#ifndef included_dictionary_h_
+#define included_dictionary_h_
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "env.h"
+
+/**
+ * Dictionary of the values found in one key column of a document. Each distinct value gets a
+ * uint32 code, so that keys are ordered and compared as integers rather than values. A document
+ * keeps one for each of its key columns (see group_t), which the threads grouping its files
+ * concurrently share.
+ *
+ * Codes are given out in the order values are first seen, and never change, as keys holding them
+ * may be in use on other threads. Their order is that of their values, and is kept in a rank for
+ * each code; a new value is ranked between its neighbors, and if there is no room left between
+ * them, all values are ranked anew. Ranks are read without locking; ranking anew is seen by
+ * readers as a change of version, upon which they read again.
+ */
+class key_dictionary_t {
+public:
+    // the code of v, which is added if new
+    uint32_t encode(const val_t& v);
+    // the order of the values of codes a and b, as with memcmp()
+    int compare(uint32_t a, uint32_t b) const {
+        if (a == b) return 0;
+        uint64_t ra, rb;
+        for (;;) {
+            const uint32_t before = version.load(std::memory_order_acquire);
+            ra = rank(a).load(std::memory_order_relaxed);
+            rb = rank(b).load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (!(before & 1) && version.load(std::memory_order_relaxed) == before) break;
+        }
+        return ra < rb ? -1 : 1;
+    }
+private:
+    // ranks are kept in chunks which double in size, and which never move once made
+    static const size_t FIRST_CHUNK_BITS = 8;
+    static const size_t CHUNKS = 32 - FIRST_CHUNK_BITS + 1;
+    // the distance between ranks, when ranked anew
+    static const uint64_t SPACING = uint64_t(1) << 32;
+
+    std::mutex mtx;
+    std::map<val_t, uint32_t> codes;
+    uint32_t count{0};
+    std::atomic<uint32_t> version{0};
+    std::atomic<std::atomic<uint64_t>*> chunks[CHUNKS] = {};
+
+    std::atomic<uint64_t>& rank(uint32_t code) const {
+        const uint64_t at = uint64_t(code) + (1 << FIRST_CHUNK_BITS);
+        const size_t bit = 63 - __builtin_clzll(at);
+        return chunks[bit - FIRST_CHUNK_BITS].load(std::memory_order_acquire)[at - (uint64_t(1) << bit)];
+    }
+    void rerank();
+};
+
+/**
+ * The codes one thread got from the dictionaries of the key columns of a document, by value
+ * identity, so that each distinct value is only looked up in a dictionary (under its lock, in an
+ * ordered map) once, and through a hash lookup after that.
+ */
+class key_encoder_t {
+public:
+    key_encoder_t(key_dictionary_t* dictionaries_in = nullptr, size_t columns = 0) : dictionaries(dictionaries_in), known(columns) {}
+    // the code of v in the dictionary of key column
+    uint32_t encode(size_t column, const val_t& v);
+private:
+    struct identity_hash_t {
+        size_t operator()(const val_t::identity_t& id) const {
+            const uint64_t h = (uint64_t(id.first) ^ uint64_t(id.second) * 0x9e3779b97f4a7c15ULL) * 0xff51afd7ed558ccdULL;
+            return size_t(h ^ (h >> 32));
+        }
+    };
+    key_dictionary_t* dictionaries;
+    std::vector<std::unordered_map<val_t::identity_t, uint32_t, identity_hash_t>> known;
+};
+
+#endif // included_dictionary_h_
@@ -2,7 +2,17 @@
 #include "parser/tokenizer.h"
 #include "parser/parser.h"
 #include "parser/csv.h"
+#include "parser/batch.h"
+#include "parser/table.h"
+#include "cache.h"
+#include <algorithm>
 #include <assert.h>
+#include <deque>
+#include <future>
+#include <mutex>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 using Token = parser::Token;
 
@@ -11,31 +21,43 @@ static void verify() {
     var_t date;
 
     date.str = "*";
-    date.value = "2021-01-05";
-    date.comps["year"] = "2021";
-    date.comps["month"] = "01";
-    date.comps["day"] = "05";
     date.fmt = "%u-%u-%u";
     date.varnames.push_back(prioritized_t("year", 0));
     date.varnames.push_back(prioritized_t("month", 1));
     date.varnames.push_back(prioritized_t("day", 2));
+    date.layout = layout_t::of(date.varnames);
+    date.read("2021-01-05");
 
     var_t date2(date);
-    date2.value = "2021-01-06";
-    date2.comps["day"] = "06";
+    date2.read("2021-01-06");
 
     std::set<std::string> fs;
     group_t g;
-    g.values.push_back(date.imprint(fs));
+    g.push_back(date.imprint(fs));
     group_t g2;
-    g2.values.push_back(date2.imprint(fs));
+    g2.push_back(date2.imprint(fs));
     assert (g<g2);
     assert (!(g2<g));
 
     verified = true;
 }
 
+// the original stdout, once claimed for CSV output by claim_stdout()
+static int stdout_fd = -1;
+
+void claim_stdout() {
+    if (stdout_fd != -1) return;
+    fflush(stdout);
+    stdout_fd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+}
+
 FILE* fopen_or_die(const char* fname, bool reading) {
+    if (!strcmp(fname, "-")) {
+        if (reading) return stdin;
+        claim_stdout();
+        return fdopen(stdout_fd, "w");
+    }
     FILE* fp = fopen(fname, reading ? "r" : "w");
     if (!fp) {
         fprintf(stderr, "failed to open file for %s: %s\n", reading ? "reading" : "writing", fname);
@@ -79,19 +101,49 @@ Context CompileCMF(FILE* fp) {
 
     return e.ctx;
 }
+size_t schema_t::bind(const std::string& name) {
+    auto it = slots.emplace(name, names.size());
+    if (it.second) names.push_back(name);
+    return it.first->second;
+}
+
+size_t schema_t::find(const std::string& name) const {
+    auto it = slots.find(name);
+    return it == slots.end() ? npos : it->second;
+}
+
+void group_t::push_back(const Value& v, uint32_t code) {
+    const size_t n = size();
+    if (n < INLINE) {
+        inline_codes[n] = code;
+    } else {
+        if (n == INLINE) spilled_codes.assign(inline_codes, inline_codes + INLINE);
+        spilled_codes.push_back(code);
+    }
+    _values.push_back(v);
+}
+
+void group_t::set(size_t index, const Value& v) {
+    _values.at(index) = v;
+    dictionaries = nullptr;
+}
+
 group_t group_t::iterate(size_t index, Value v) const {
     group_t g(*this);
-    g.values[index] = v;
+    g.set(index, v);
     return g;
 }
 
 group_t group_t::exclude(size_t index) const {
-    group_t g(*this);
-    g.values.erase(g.values.begin() + index);
+    // the values after index move to another column, and so to another dictionary, so the result
+    // is not encoded
+    group_t g(_values.get_allocator().arena);
+    g.reserve(size() - 1);
+    for (size_t i = 0; i < size(); ++i) if (i != index) g.push_back(_values[i]);
     return g;
 }
 
-document_t::document_t(const char* path, std::set<std::string>* fitness_set_in) {
+document_t::document_t(const char* path, std::set<std::string>* fitness_set_in) : schema(new schema_t()) {
     fitness_set = fitness_set_in ?: new std::set<std::string>();
     if (!verified) verify();
     cmf_path = path;
@@ -115,11 +167,20 @@ document_t::document_t(const char* path, std::set<std::string>* fitness_set_in)
     for (const auto& aspect : ctx->aspects) {
         if (aspect.priority == -1) {
             missing.emplace_back(aspect.label);
+        } else {
+            schema->bind(aspect.label);
         }
     }
+    for (const auto& m : missing) missing_slots.push_back(schema->bind(m));
+    for (const auto& v : aggregates) aggregate_slots.push_back(schema->bind(ctx->varnames[v]));
+    for (const auto& v : values) value_slots.push_back(schema->bind(ctx->varnames[v]));
+    if (ctx->aspect_source != "") source_slot = schema->bind(ctx->aspect_source);
+    dictionaries.reset(new key_dictionary_t[keys.size()], std::default_delete<key_dictionary_t[]>());
+    encoder = key_encoder_t(dictionaries.get(), keys.size());
 }
 
 void document_t::align(const std::vector<std::string>& headers) {
+    bind_aspect();
     aligned.clear();
     for (size_t i = 0; i < headers.size(); ++i) {
         std::string header = headers[i];
@@ -137,47 +198,133 @@ void document_t::align(const std::vector<std::string>& headers) {
 }
 
 void document_t::record_state(const Value& aspect_value) {
-    group_t gk;
+    if (staging) {
+        staging->phases.push_back(phase);
+        staging->aspect_values.push_back(aspect_value);
+        for (const auto* vars : { &keys, &aggregates, &values }) {
+            for (const auto& v : *vars) {
+                if (v->fit.size() > 0) {
+                    staging->pending.emplace_back(staging->vals.size(), v->stage());
+                    staging->vals.emplace_back();
+                } else {
+                    staging->vals.push_back(make_value(arena.get(), v->stage()));
+                }
+            }
+        }
+        return;
+    }
+    const size_t nkeys = keys.size(), naggregates = aggregates.size();
+    // streamed rows are not kept, and so are not made in the arena, which would only ever grow,
+    // but in a scratch arena
+    arena_t* const in = sink ? stream_arena() : arena.get();
+    record(aspect_value, [&](size_t slot) {
+        if (slot < nkeys) return keys[slot]->imprint(*fitness_set, in);
+        if (slot < nkeys + naggregates) return aggregates[slot - nkeys]->imprint(*fitness_set, in);
+        return values[slot - nkeys - naggregates]->imprint(*fitness_set, in);
+    });
+}
 
-    for (const auto& v : keys) {
-        gk.values.push_back(v->imprint(*fitness_set));
+arena_t* document_t::stream_arena() {
+    // the rows made in the scratch arena are gone once the sink has had them, so it is replaced
+    // every so often, along with the text pooled in it
+    if (!scratch || ++scratch_rows == STREAM_ROWS) {
+        if (scratch) streamed += val_t::interned(scratch.get());
+        scratch = std::make_shared<arena_t>();
+        scratch_rows = 0;
     }
+    return scratch.get();
+}
 
-    bool existed = data.count(gk) > 0;
-    if (aspect != "" && existed && aggregates.size() == 0) {
-        // insert aspect only and move on as the remaining data should be the same (and even if it isn't, this would simply overwrite it)
-        data[gk][aspect] = aspect_value;
+Value document_t::staging_t::take(size_t index, std::set<std::string>& fitness_set) {
+    if (vals[index]) return vals[index];
+    auto it = std::lower_bound(pending.begin(), pending.end(), index, [](const std::pair<size_t, mutable_val_t>& p, size_t i) { return p.first < i; });
+    if (it == pending.end() || it->first != index) throw std::runtime_error("missing staged value");
+    var_t::resolve(it->second, fitness_set);
+    return make_value(arena, it->second);
+}
+
+void document_t::commit(staging_t& staged) {
+    const uint32_t base = phase;
+    for (size_t row = 0; row < staged.rows(); ++row) {
+        phase = base + staged.phases[row];
+        const size_t at = row * staged.stride;
+        record(staged.aspect_values[row], [&](size_t slot) { return staged.take(at + slot, *fitness_set); });
+    }
+    phase = base;
+}
+
+template<typename F> void document_t::record(const Value& aspect_value, F value) {
+    // values are only imprinted once needed, in the order they always have been, as fit values
+    // may add to the fitness set
+    const size_t nkeys = keys.size(), naggregates = aggregates.size();
+    group_t gk(sink ? nullptr : arena.get(), sink ? nullptr : dictionaries.get());
+    gk.reserve(nkeys);
+
+    for (size_t i = 0; i < nkeys; ++i) {
+        const Value& v = value(i);
+        if (sink) {
+            gk.push_back(v);
+        } else {
+            gk.push_back(v, encoder.encode(i, *v));
+        }
+    }
+
+    if (sink) {
+        // streaming: nothing is kept, so every row is an entry of its own
+        valuemap_t valuemap(schema);
+        for (size_t slot : missing_slots) {
+            valuemap[slot] = std::make_shared<val_t>("0");
+        }
+        for (size_t i = 0; i < values.size(); ++i) {
+            valuemap[value_slots[i]] = value(nkeys + naggregates + i);
+        }
+        sink(gk, valuemap);
         return;
     }
 
-    std::map<std::string,Value>& valuemap = data[gk];
+    auto it = data.lower_bound(gk);
+    bool existed = it != data.end() && !(gk < it->first);
+    if (!existed) it = data.emplace_hint(it, std::move(gk), valuemap_t(schema, arena.get()));
+    apply(it->second, existed, aspect_slot, phase, aspect_value, arena.get(), value);
+}
+
+template<typename F> void document_t::apply(valuemap_t& valuemap, bool existed, size_t label, uint32_t curr_phase, const Value& aspect_value, arena_t* arena, F value) const {
+    const size_t nkeys = keys.size(), naggregates = aggregates.size();
+
+    if (label != schema_t::npos && existed && aggregates.size() == 0) {
+        // insert aspect only and move on as the remaining data should be the same (and even if it isn't, this would simply overwrite it)
+        valuemap[label] = aspect_value;
+        return;
+    }
 
     if (existed) {
-        for (const auto &v : aggregates) {
-            valuemap[ctx->varnames[v]]->aggregate(*v->imprint(*fitness_set), phase);
+        for (size_t i = 0; i < naggregates; ++i) {
+            valuemap[aggregate_slots[i]]->aggregate(*value(nkeys + i), curr_phase);
         }
     } else {
-        for (const auto& m : missing) {
-            valuemap[m] = std::make_shared<val_t>("0");
+        for (size_t slot : missing_slots) {
+            valuemap[slot] = make_value(arena, "0");
         }
-        for (const auto &v : aggregates) {
-            valuemap[ctx->varnames[v]] = v->imprint(*fitness_set);
-            valuemap[ctx->varnames[v]]->phase = phase;
+        for (size_t i = 0; i < naggregates; ++i) {
+            Value& v = valuemap[aggregate_slots[i]];
+            v = value(nkeys + i);
+            v->phase = curr_phase;
         }
-        for (const auto &v : values) {
-            valuemap[ctx->varnames[v]] = v->imprint(*fitness_set);
+        for (size_t i = 0; i < values.size(); ++i) {
+            valuemap[value_slots[i]] = value(nkeys + naggregates + i);
         }
     }
 
-    if (aspect != "") {
-        valuemap[aspect] = ctx->aspect_source != "" ? valuemap[ctx->aspect_source]->clone() : aspect_value;
+    if (label != schema_t::npos) {
+        valuemap[label] = source_slot != schema_t::npos ? valuemap[source_slot]->clone(arena) : aspect_value;
     }
 }
 
-void document_t::process(const std::vector<std::string>& row) {
+void document_t::process(const csv_row_t& row) {
     // update vars
     for (const auto& v : aligned) {
-        v->read(row.at(v->index));
+        const csv_field_t& field = row.at(v->index);
+        v->read(field.ptr, field.len);
     }
     if (trail.size() == 0) {
         record_state();
@@ -186,40 +333,74 @@ void document_t::process(const std::vector<std::string>& row) {
     // iterate
     for (size_t i = ctx->trailing->index; i < row.size(); ++i) {
         ctx->trailing->read(trail[i - ctx->trailing->index]);
-        Value v = std::make_shared<val_t>(row.at(i));
+        Value v = make_value(arena.get(), row.at(i).str());
         record_state(v);
     }
 }
 
-bool group_t::operator<(const group_t& other) const {
-    for (size_t i = 0; i < values.size(); ++i) {
-        if (*values[i] < *other.values[i]) return true;
-        if (*other.values[i] < *values[i]) return false;
+template<size_t N> static inline bool codes_less(const key_dictionary_t* dictionaries, const uint32_t* a, const uint32_t* b, size_t n = N) {
+    for (size_t i = 0; i < n; ++i) {
+        if (a[i] != b[i]) return dictionaries[i].compare(a[i], b[i]) < 0;
     }
     return false;
 }
 
+bool group_t::operator<(const group_t& other) const {
+    if (!dictionaries || dictionaries != other.dictionaries) {
+        for (size_t i = 0; i < size(); ++i) {
+            if (*_values[i] < *other._values[i]) return true;
+            if (*other._values[i] < *_values[i]) return false;
+        }
+        return false;
+    }
+    const uint32_t* a = codes();
+    const uint32_t* b = other.codes();
+    switch (size()) {
+    case 2: return codes_less<2>(dictionaries, a, b);
+    case 3: return codes_less<3>(dictionaries, a, b);
+    default: return codes_less<0>(dictionaries, a, b, size());
+    }
+}
+
 std::string group_t::to_string() const {
     std::string s = "(group) [";
-    for (size_t i = 0; i < values.size(); ++i) {
-        s += (i ? ", " : "") + values[i]->to_string();
+    for (size_t i = 0; i < _values.size(); ++i) {
+        s += (i ? ", " : "") + _values[i]->to_string();
     }
     return s + "]";
 }
 
-void document_t::load_single(FILE* fp) {
+size_t document_t::load_rows(csv_reader& reader, bool verbose) {
     ++phase;
-    csv reader(fp);
-    std::vector<std::string> row;
+    load_header(reader, verbose);
+    return load_body(reader);
+}
+
+void document_t::load_header(csv_reader& reader, bool verbose) {
+    csv_row_t row;
     if (!reader.read(row)) {
         fprintf(stderr, "could not read header from CSV file\n");
         exit(4);
     }
-    align(row);
-    printf("Aligned vars:\n");
-    for (const auto& v : ctx->vars) {
-        printf("- %s = %s\n", v.first.c_str(), v.second->to_string().c_str());
+    std::vector<std::string> headers;
+    for (const auto& field : row) headers.push_back(field.str());
+    align(headers);
+    if (trail.size() == 0) {
+        // only the aligned columns are ever looked at
+        std::vector<bool> needed(headers.size());
+        for (const auto& v : aligned) needed[v->index] = true;
+        reader.project(needed);
+    }
+    if (verbose) {
+        printf("Aligned vars:\n");
+        for (const auto& v : ctx->vars) {
+            printf("- %s = %s\n", v.first.c_str(), v.second->to_string().c_str());
+        }
     }
+}
+
+size_t document_t::load_body(csv_reader& reader) {
+    csv_row_t row;
     size_t count = 0;
     while (reader.read(row)) {
         // // 2020-01-22,Burma,,0,0,0
@@ -230,36 +411,676 @@ void document_t::load_single(FILE* fp) {
         ++count;
         if (count % 100000 == 0) { printf("%zu\r", count); fflush(stdout); }
     }
+    return count;
+}
+
+size_t document_t::load_table(const table_reader& table, bool verbose) {
+    ++phase;
+    const auto& columns = table.columns();
+    std::vector<std::string> headers;
+    for (const auto& c : columns) headers.push_back(c.name);
+    align(headers);
+    if (verbose) {
+        printf("Aligned vars:\n");
+        for (const auto& v : ctx->vars) {
+            printf("- %s = %s\n", v.first.c_str(), v.second->to_string().c_str());
+        }
+    }
+    // each distinct cell of a dictionary column is read into its var once, up front; rows then
+    // only copy the result, rather than scanning the text again
+    struct read_t {
+        std::string value;
+        comps_t comps;
+    };
+    std::vector<std::vector<read_t>> reads(aligned.size());
+    for (size_t a = 0; a < aligned.size(); ++a) {
+        const Var& v = aligned[a];
+        const auto& column = columns.at(v->index);
+        if (column.numeric || v->fit.size() > 0) continue;
+        for (const auto& entry : column.dict) {
+            v->read(entry);
+            reads[a].push_back(read_t{v->value, v->comps});
+        }
+    }
+    char digits[24];
+    for (size_t r = 0; r < table.rows(); ++r) {
+        for (size_t a = 0; a < aligned.size(); ++a) {
+            const Var& v = aligned[a];
+            const auto& column = columns[v->index];
+            if (column.numeric && v->passthrough() && column.numbers[r] >= 0) {
+                // the number is the value, so there is no text to make and parse again (negative
+                // cells are not numeric values, but text)
+                v->read_number(column.numbers[r]);
+            } else if (column.numeric) {
+                v->read(digits, snprintf(digits, sizeof(digits), "%lld", (long long)column.numbers[r]));
+            } else if (reads[a].size() == 0) {
+                v->read(column.dict[column.codes[r]]);
+            } else {
+                const read_t& read = reads[a][column.codes[r]];
+                v->numbered = false;
+                v->value = read.value;
+                if (v->fmt.size() > 0) v->comps = read.comps;
+            }
+        }
+        if (trail.size() == 0) {
+            record_state();
+            continue;
+        }
+        for (size_t i = ctx->trailing->index; i < columns.size(); ++i) {
+            ctx->trailing->read(trail[i - ctx->trailing->index]);
+            record_state(make_value(arena.get(), columns[i].text(r)));
+        }
+    }
+    return table.rows();
+}
+
+void document_t::load_single(FILE* fp) {
+    std::unique_ptr<csv_reader> reader = csv_reader::open(fp, jobs, io);
+    size_t count = load_rows(*reader, true);
     printf("Read %zu lines (%zu entries)\n", count, data.size());
+    queue_stats_t stats;
+    if (reader->io_stats(stats)) {
+        printf("Input: %zu chunks; parser stalled %zu times (%.3f s) waiting for input, reader stalled %zu times (%.3f s) waiting for parser\n", stats.chunks, stats.consumer_waits, stats.consumer_wait_ns / 1e9, stats.producer_waits, stats.producer_wait_ns / 1e9);
+    }
 }
 
-void document_t::load_from_disk(cliargs& argiter) {
+void document_t::load_batch(const std::vector<std::string>& paths) {
+    file_batch_t batch(paths);
+    loaded_file_t file;
+    size_t count = 0;
+    while (batch.next(file)) {
+        if (file.error.size() > 0) {
+            fprintf(stderr, "failed to read %s: %s\n", file.path.c_str(), file.error.c_str());
+            exit(2);
+        }
+        if (table_reader::is_table(file.data.data(), file.data.size())) {
+            count += load_table(table_reader(std::move(file.data)), false);
+        } else if (input_t::compressed((const unsigned char*)file.data.data(), file.data.size())) {
+            // compressed files are decompressed as usual, from the file itself
+            std::unique_ptr<csv_reader> reader = csv_reader::open(fopen_or_die(file.path.c_str(), fmode_reading));
+            count += load_rows(*reader, false);
+        } else {
+            buffer_csv reader(std::move(file.data));
+            count += load_rows(reader, false);
+        }
+    }
+    printf("Read %zu files using %s, %zu lines (%zu entries)\n", paths.size(), batch.backend(), count, data.size());
+}
+
+// the CSV files in the directory at path, in name order, or an empty list if path is not a directory
+static std::vector<std::string> list_directory(const char* path) {
+    std::vector<std::string> paths;
+    DIR* dir = opendir(path);
+    if (!dir) return paths;
+    while (struct dirent* entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        for (const char* ext : { ".csv", ".csv.gz", ".csv.zst", ".cmb" }) {
+            size_t len = strlen(ext);
+            if (name.length() > len && name.substr(name.length() - len) == ext) {
+                paths.push_back(std::string(path) + "/" + name);
+                break;
+            }
+        }
+    }
+    closedir(dir);
+    std::sort(paths.begin(), paths.end());
+    if (paths.empty()) {
+        fprintf(stderr, "no CSV files found in directory %s\n", path);
+        exit(2);
+    }
+    return paths;
+}
+
+void document_t::load_path(const char* path) {
+    std::vector<std::string> paths = list_directory(path);
+    if (paths.size() > 0) {
+        load_batch(paths);
+    } else if (strcmp(path, "-") && table_reader::is_table(path)) {
+        table_reader table(fopen_or_die(path, fmode_reading));
+        size_t count = load_table(table, true);
+        printf("Read %zu rows from table (%zu entries)\n", count, data.size());
+    } else {
+        load_single(fopen_or_die(path, fmode_reading));
+    }
+}
+
+void document_t::resolve_keys(staging_t& staged) {
+    const size_t resolved = keys.size() + aggregates.size();
+    for (auto& p : staged.pending) {
+        if (p.first % staged.stride >= resolved) throw std::runtime_error("fit values cannot be resolved ahead of time");
+        var_t::resolve(p.second, *fitness_set);
+    }
+}
+
+void document_t::group(staging_t& staged, size_t label, uint32_t base) const {
+    const size_t nkeys = keys.size(), stride = staged.stride;
+    for (auto& p : staged.pending) staged.vals[p.first] = make_value(staged.arena, p.second);
+    staged.pending.clear();
+
+    auto& codes = staged.codes;
+    codes.resize(staged.rows() * nkeys);
+    // files are grouped on threads of their own, each with codes of its own
+    key_encoder_t file_encoder(dictionaries.get(), nkeys);
+    for (size_t row = 0; row < staged.rows(); ++row) {
+        for (size_t k = 0; k < nkeys; ++k) codes[row * nkeys + k] = file_encoder.encode(k, *staged.vals[row * stride + k]);
+    }
+
+    auto& order = staged.order;
+    order.resize(staged.rows());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    const Value* vals = staged.vals.data();
+    const uint32_t* keycodes = codes.data();
+    const key_dictionary_t* columns = dictionaries.get();
+    auto less = [=](uint32_t a, uint32_t b) {
+        for (size_t k = 0; k < nkeys; ++k) {
+            const uint32_t x = keycodes[a * nkeys + k], y = keycodes[b * nkeys + k];
+            if (x != y) return columns[k].compare(x, y) < 0;
+        }
+        return false;
+    };
+    // rows usually come in key order already
+    if (!std::is_sorted(order.begin(), order.end(), less)) std::stable_sort(order.begin(), order.end(), less);
+
+    // the values recorded for the first row of an entry are aggregated into by the rows after it;
+    // they are copies, so that the rows can still be recorded anew, should the entry already exist
+    const bool copy = aggregates.size() > 0;
+    for (size_t r = 0; r < order.size(); ++r) {
+        const size_t row = order[r], at = row * stride;
+        bool existed = r > 0 && !less(order[r - 1], row);
+        if (!existed) staged.entries.emplace_back(r, valuemap_t(schema, staged.arena));
+        apply(staged.entries.back().second, existed, label, base + staged.phases[row], staged.aspect_values[row], staged.arena, [&](size_t slot) {
+            return copy && !existed ? vals[at + slot]->clone(staged.arena) : vals[at + slot];
+        });
+    }
+}
+
+void document_t::merge(staging_t& staged, size_t label) {
+    const size_t nkeys = keys.size();
+    const auto& order = staged.order;
+    // the entries come in key order, so the position in data only ever moves forward
+    auto it = data.begin();
+    for (size_t e = 0; e < staged.entries.size(); ++e) {
+        const size_t begin = staged.entries[e].first;
+        const size_t end = e + 1 < staged.entries.size() ? staged.entries[e + 1].first : order.size();
+        const size_t first = order[begin];
+        group_t gk(arena.get(), dictionaries.get());
+        gk.reserve(nkeys);
+        for (size_t k = 0; k < nkeys; ++k) gk.push_back(staged.vals[first * staged.stride + k], staged.codes[first * nkeys + k]);
+        while (it != data.end() && it->first < gk) ++it;
+        if (it == data.end() || gk < it->first) {
+            it = data.emplace_hint(it, std::move(gk), std::move(staged.entries[e].second));
+            continue;
+        }
+        // the entry is recorded anew on top of the existing one, one row at a time
+        for (size_t r = begin; r < end; ++r) {
+            const size_t row = order[r], at = row * staged.stride;
+            apply(it->second, true, label, phase + staged.phases[row], staged.aspect_values[row], arena.get(), [&](size_t slot) { return staged.vals[at + slot]; });
+        }
+    }
+}
+
+void document_t::load_concurrently(const std::vector<load_t>& loads, size_t jobs) {
+    std::vector<std::unique_ptr<document_t>> parts;
+    std::vector<staging_t> staged(loads.size());
+    for (size_t i = 0; i < loads.size(); ++i) {
+        document_t* doc = loads[i].doc;
+        parts.emplace_back(new document_t(doc->cmf_path.c_str(), doc->fitness_set));
+        parts[i]->io = doc->io;
+        parts[i]->aspect = loads[i].label;
+        parts[i]->staging = &staged[i];
+        // the entries staged by the part end up in the data of the document
+        staged[i].arena = parts[i]->arena.get();
+        doc->borrow(*parts[i]);
+        staged[i].stride = doc->keys.size() + doc->aggregates.size() + doc->values.size();
+    }
+    // the loads of each document, in order, and the slots of their aspects, which are bound up
+    // front as the schemas of the documents must not change once grouping is under way
+    std::map<document_t*, std::vector<size_t>> files;
+    std::vector<size_t> labels(loads.size());
+    for (size_t i = 0; i < loads.size(); ++i) {
+        document_t* doc = loads[i].doc;
+        files[doc].push_back(i);
+        labels[i] = loads[i].label == "" ? schema_t::npos : doc->schema->bind(loads[i].label);
+    }
+    // fit values among the plain values are only resolved for new entries, which cannot be known
+    // ahead of time; otherwise, once its keys are resolved, a file can be grouped by key on its own
+    // and merged into data in a single pass, rather than being committed row by row
+    std::map<document_t*, bool> grouped;
+    std::map<document_t*, uint32_t> bases;
+    for (const auto& f : files) {
+        bool& g = grouped[f.first] = true;
+        for (const auto& v : f.first->values) g &= v->fit.size() == 0;
+        bases[f.first] = f.first->phase;
+    }
+    std::vector<std::future<void>> grouping(loads.size());
+    // each document merges its files on a thread of its own, once they have all been resolved
+    std::vector<std::future<void>> merging;
+    auto merge_all = [&](document_t* doc) {
+        for (size_t i : files.at(doc)) {
+            grouping[i].get();
+            doc->merge(staged[i], labels[i]);
+            doc->phase += parts[i]->phase;
+            doc->aspect = loads[i].label;
+            staged[i] = staging_t();
+        }
+    };
+    // at most jobs files are staged at once, and staging runs ahead of everything else
+    std::deque<std::future<void>> pending;
+    size_t dispatched = 0;
+    for (size_t i = 0; i < loads.size(); ++i) {
+        while (pending.size() < jobs && dispatched < loads.size()) {
+            document_t* part = parts[dispatched].get();
+            const std::string& path = loads[dispatched++].path;
+            pending.push_back(std::async(std::launch::async, [part, &path] { part->load_path(path.c_str()); }));
+        }
+        pending.front().get();
+        pending.pop_front();
+        document_t* doc = loads[i].doc;
+        // the fitness set sees the fit values of all files in the order they were given, whether
+        // resolved here or when committing, exactly as when loading the files one after the other
+        if (grouped[doc]) {
+            doc->resolve_keys(staged[i]);
+            grouping[i] = std::async(std::launch::async, &document_t::group, doc, std::ref(staged[i]), labels[i], bases[doc]);
+            bases[doc] += parts[i]->phase;
+            if (i == files[doc].back()) merging.push_back(std::async(std::launch::async, merge_all, doc));
+            continue;
+        }
+        doc->aspect = loads[i].label;
+        doc->commit(staged[i]);
+        doc->phase += parts[i]->phase;
+        staged[i] = staging_t();
+    }
+    for (auto& m : merging) m.get();
+}
+
+// whether the first size bytes of the file at path end with a newline
+static bool ends_with_newline(const std::string& path, uint64_t size) {
+    FILE* fp = fopen(path.c_str(), "r");
+    if (!fp) return false;
+    int last = size > 0 && 0 == fseeko(fp, size - 1, SEEK_SET) ? fgetc(fp) : EOF;
+    fclose(fp);
+    return last == '\n';
+}
+
+std::vector<std::string> document_t::input_labels() const {
+    std::vector<std::string> labels;
     if (ctx->aspects.size() > 0) {
         // aspect based which means path is multiple files
         for (size_t i = 0; i < ctx->aspects.size(); ++i) {
             if (ctx->aspects[i].priority == -1) {
                 continue;
             }
-            aspect = ctx->aspects[i].label;
-            load_single(fopen_or_die(argiter.next(), fmode_reading));
+            labels.push_back(ctx->aspects[i].label);
         }
     } else {
-        load_single(fopen_or_die(argiter.next(), fmode_reading));
+        labels.push_back(aspect);
     }
+    return labels;
 }
 
-void document_t::write_single(const document_t& doc, FILE* fp) {
-    csv writer(fp);
-    std::vector<std::string> row;
-    size_t pretrail = values.size() - (ctx->trailing ? 1 : 0);
-    for (const auto& k : keys) pretrail += k->fit.size() == 0;
+std::vector<std::string> document_t::input_paths(cliargs& argiter) const {
+    std::vector<std::string> paths;
+    for (size_t i = input_labels().size(); i > 0; --i) paths.push_back(argiter.next());
+    return paths;
+}
+
+void document_t::load_from_disk(cliargs& argiter) {
+    load_from_disk(input_paths(argiter));
+}
 
-    row.resize(pretrail);
+void document_t::load_from_disk(const std::vector<Document>& documents, const std::vector<std::vector<std::string>>& paths) {
+    std::vector<load_t> loads;
+    bool concurrent = true;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        const auto labels = documents[i]->input_labels();
+        for (size_t j = 0; j < paths[i].size(); ++j) loads.push_back(load_t{documents[i].get(), paths[i][j], labels[j]});
+        // snapshots are keyed on the fitness set as it was before loading, so they are taken and
+        // restored one document at a time
+        concurrent &= documents[i]->jobs > 1 && documents[i]->cache_dir.size() == 0 && !documents[i]->sink;
+    }
+    if (concurrent && documents.size() > 1) {
+        load_concurrently(loads, documents[0]->jobs);
+        return;
+    }
+    for (size_t i = 0; i < documents.size(); ++i) documents[i]->load_from_disk(paths[i]);
+}
 
-    // generate header and trail
-    for (const auto& var : aligned) {
-        row[var->index] = var->str;
+void document_t::load_from_disk(const std::vector<std::string>& paths) {
+    const auto labels = input_labels();
+    std::string slot;
+    uint64_t key = 0;
+    std::set<std::string> known;
+    tail_t tail;
+    if (cache_dir.size() > 0 && !sink && snapshot_slot(paths, labels, slot, key, tail)) {
+        known = *fitness_set;
+        if (restore_snapshot(slot, key, tail)) {
+            aspect = labels.back();
+            if (tail.path.size() > 0 && load_tail(tail)) store_snapshot(slot, key, known, tail);
+            return;
+        }
+    }
+    struct stat before;
+    if (tail.path.size() > 0 && stat(tail.path.c_str(), &before)) tail.path.clear();
+    if (jobs > 1 && paths.size() > 1) {
+        std::vector<load_t> loads;
+        for (size_t i = 0; i < paths.size(); ++i) loads.push_back(load_t{this, paths[i], labels[i]});
+        load_concurrently(loads, jobs);
+    } else {
+        for (size_t i = 0; i < paths.size(); ++i) {
+            aspect = labels[i];
+            load_path(paths[i].c_str());
+        }
+    }
+    if (tail.path.size() > 0) {
+        // the snapshot must cover exactly the bytes loaded, which is unknown if the file grew meanwhile
+        struct stat after;
+        hasher_t prefix;
+        if (stat(tail.path.c_str(), &after) || after.st_size != before.st_size || !prefix.add_range(tail.path, 0, after.st_size)) {
+            fprintf(stderr, "warning: %s changed while being loaded; not taking a snapshot\n", tail.path.c_str());
+            return;
+        }
+        tail.offset = after.st_size;
+        tail.prefix = prefix.h;
+        tail.terminated = ends_with_newline(tail.path, after.st_size);
+    }
+    if (slot.size() > 0) store_snapshot(slot, key, known, tail);
+}
+
+bool document_t::load_tail(tail_t& tail) {
+    struct stat st;
+    if (stat(tail.path.c_str(), &st) || uint64_t(st.st_size) <= tail.offset) return false;
+    const uint64_t size = st.st_size;
+    hasher_t prefix;
+    prefix.h = tail.prefix;
+    if (!prefix.add_range(tail.path, tail.offset, size)) return false;
+    mmap_csv reader(fopen_or_die(tail.path.c_str(), fmode_reading), size);
+    // the appended rows belong to the same load as the restored ones, so the phase stays put and
+    // aggregates keep adding up
+    load_header(reader, false);
+    reader.seek(tail.offset);
+    size_t count = load_body(reader);
+    printf("Read %zu appended lines (%zu entries)\n", count, data.size());
+    tail.offset = size;
+    tail.prefix = prefix.h;
+    tail.terminated = ends_with_newline(tail.path, size);
+    return true;
+}
+
+// version of the snapshot format; bump whenever the layout or the meaning of loaded data changes
+static const uint64_t SNAPSHOT_VERSION = 7;
+static const char* SNAPSHOT_MAGIC = "csvman snapshot";
+
+// whether path is a regular, uncompressed file, i.e. one which rows can be appended to
+static bool tailable(const std::string& path) {
+    struct stat st;
+    if (stat(path.c_str(), &st) || !S_ISREG(st.st_mode)) return false;
+    unsigned char magic[4] = {0};
+    FILE* fp = fopen(path.c_str(), "r");
+    if (!fp) return false;
+    size_t len = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    return !input_t::compressed(magic, len) && !table_reader::is_table(path);
+}
+
+bool document_t::snapshot_slot(const std::vector<std::string>& paths, const std::vector<std::string>& labels, std::string& slot, uint64_t& key, tail_t& tail) const {
+    hasher_t slot_hash, key_hash;
+    key_hash.add_u64(SNAPSHOT_VERSION);
+    if (!key_hash.add_file(cmf_path)) return false;
+    char* real = realpath(cmf_path.c_str(), nullptr);
+    slot_hash.add(real ? std::string(real) : cmf_path);
+    free(real);
+    for (size_t i = 0; i < paths.size(); ++i) {
+        const std::string& path = paths[i];
+        // stdin cannot be identified
+        if (path == "-") return false;
+        real = realpath(path.c_str(), nullptr);
+        slot_hash.add(real ? std::string(real) : path);
+        free(real);
+        slot_hash.add(labels[i]);
+        key_hash.add(labels[i]);
+        if (paths.size() == 1 && tailable(path)) {
+            // keyed on its loaded prefix instead, which is checked when restoring
+            tail.path = path;
+            continue;
+        }
+        if (!key_hash.add_identity(path)) return false;
+        for (const auto& file : list_directory(path.c_str())) {
+            key_hash.add(file);
+            if (!key_hash.add_identity(file)) return false;
+        }
+    }
+    // the fitness set decides which alternatives are imprinted, so it is part of the slot too
+    slot_hash.add_u64(fitness_set->size());
+    for (const auto& f : *fitness_set) slot_hash.add(f);
+    char name[32];
+    sprintf(name, "/%016llx.snapshot", (unsigned long long)slot_hash.h);
+    slot = cache_dir + name;
+    key = key_hash.h ^ slot_hash.h;
+    return true;
+}
+
+bool document_t::restore_snapshot(const std::string& slot, uint64_t key, tail_t& tail) {
+    snapshot_reader_t in(slot);
+    if (!in.ok()) return false;
+    data_t restored(arena.get());
+    std::vector<std::string> added;
+    uint32_t restored_phase;
+    try {
+        if (in.str() != SNAPSHOT_MAGIC || in.u64() != SNAPSHOT_VERSION || in.u64() != key) return false;
+        tail.offset = in.u64();
+        tail.prefix = in.u64();
+        tail.terminated = in.u8();
+        if (tail.path.size() > 0) {
+            // the part loaded before must still be there, unchanged, and if anything was appended,
+            // it must not be the continuation of a row which was loaded in part
+            hasher_t prefix;
+            struct stat st;
+            if (!prefix.add_range(tail.path, 0, tail.offset) || prefix.h != tail.prefix) return false;
+            if (stat(tail.path.c_str(), &st) || (uint64_t(st.st_size) > tail.offset && !tail.terminated)) return false;
+        }
+        restored_phase = in.u32();
+        added.resize(in.u32());
+        for (auto& f : added) f = in.str();
+        // the schema the snapshot was taken with, bound to this one
+        std::vector<size_t> slots(in.u32());
+        for (auto& slot : slots) slot = schema->bind(in.str());
+        for (uint64_t entries = in.u64(); entries > 0; --entries) {
+            group_t g(arena.get(), dictionaries.get());
+            const uint32_t nkeys = in.u32();
+            for (uint32_t k = 0; k < nkeys; ++k) {
+                Value v = in.value(arena.get());
+                g.push_back(v, encoder.encode(k, *v));
+            }
+            // entries were written in order, so each one goes at the end
+            valuemap_t& valuemap = restored.emplace_hint(restored.end(), std::move(g), valuemap_t(schema, arena.get()))->second;
+            for (uint32_t n = in.u32(); n > 0; --n) {
+                uint32_t slot = in.u32();
+                if (slot >= slots.size()) throw std::runtime_error("invalid slot");
+                valuemap[slots[slot]] = in.value(arena.get());
+            }
+        }
+        if (!in.at_end()) throw std::runtime_error("trailing data");
+    } catch (const std::exception& e) {
+        fprintf(stderr, "warning: ignoring snapshot %s: %s\n", slot.c_str(), e.what());
+        return false;
+    }
+    data.swap(restored);
+    phase = restored_phase;
+    fitness_set->insert(added.begin(), added.end());
+    printf("Restored %zu entries from snapshot %s\n", data.size(), slot.c_str());
+    return true;
+}
+
+void document_t::store_snapshot(const std::string& slot, uint64_t key, const std::set<std::string>& known, const tail_t& tail) const {
+    snapshot_writer_t out;
+    out.str(SNAPSHOT_MAGIC);
+    out.u64(SNAPSHOT_VERSION);
+    out.u64(key);
+    out.u64(tail.offset);
+    out.u64(tail.prefix);
+    out.u8(tail.terminated);
+    out.u32(phase);
+    std::vector<const std::string*> added;
+    for (const auto& f : *fitness_set) if (!known.count(f)) added.push_back(&f);
+    out.u32(added.size());
+    for (const auto* f : added) out.str(*f);
+    out.u32(schema->names.size());
+    for (const auto& name : schema->names) out.str(name);
+    out.u64(data.size());
+    for (const auto& entry : data) {
+        out.u32(entry.first.size());
+        for (const auto& v : entry.first.values()) out.value(v.get());
+        const auto& values = entry.second.values;
+        uint32_t n = 0;
+        for (const auto& v : values) n += v != nullptr;
+        out.u32(n);
+        for (size_t slot = 0; slot < values.size(); ++slot) {
+            if (!values[slot]) continue;
+            out.u32(slot);
+            out.value(values[slot].get());
+        }
+    }
+    mkdir(cache_dir.c_str(), 0777);
+    if (!out.save(slot)) {
+        fprintf(stderr, "warning: failed to write snapshot %s\n", slot.c_str());
+    }
+}
+
+static inline void write_value(row_writer& writer, const val_t* value) {
+    if (!value) {
+        writer.field(int64_t(0));
+    } else if (value->is_number()) {
+        writer.field(value->get_number());
+    } else {
+        writer.field(value->get_value());
+    }
+}
+
+// entries are written by write_parallel in blocks of this many
+static const size_t WRITE_BLOCK = 1 << 15;
+
+static inline bool table_path(const std::string& path) {
+    return path.size() > 4 && path.compare(path.size() - 4, 4, ".cmb") == 0;
+}
+
+// split path into its base name and its extension, if it is one of the known ones
+static void split_extension(const std::string& path, std::string& basename, std::string& extension) {
+    basename = path;
+    extension = ".csv";
+    for (const char* ext : { ".csv", ".csv.gz", ".csv.zst", ".cmb" }) {
+        size_t len = strlen(ext);
+        if (path.length() > len && path.substr(path.length() - len) == ext) {
+            basename = path.substr(0, path.length() - len);
+            extension = ext;
+        }
+    }
+}
+
+// copy v and the vars it is made up of, for use on another thread; vars shared between the
+// originals are shared between the copies too
+static Var copy_var(const Var& v, std::map<const var_t*, Var>& copies) {
+    if (!v) return v;
+    Var& copy = copies[v.get()];
+    if (copy) return copy;
+    copy = std::make_shared<var_t>(*v);
+    for (auto& f : copy->fit) f = copy_var(f, copies);
+    return copy;
+}
+
+void document_t::write_parallel(const document_t& doc, const std::vector<std::string>& paths) {
+    const std::vector<std::string> header = pretrail_header();
+    std::vector<bool> plain(header.size());
+    for (const auto& var : aligned) plain[var->index] = var->plain();
+
+    // the entries are split into ranges at these points
+    size_t ranges = shards ? jobs : (doc.data.size() + WRITE_BLOCK - 1) / WRITE_BLOCK;
+    if (ranges == 0) ranges = 1;
+    const size_t per_range = std::max<size_t>(1, (doc.data.size() + ranges - 1) / ranges);
+    std::vector<decltype(doc.data.begin())> bounds;
+    size_t n = 0;
+    for (auto it = doc.data.begin(); it != doc.data.end(); ++it, ++n) {
+        if (n % per_range == 0) bounds.push_back(it);
+    }
+    while (bounds.size() <= ranges) bounds.push_back(doc.data.end());
+
+    // format range i to writer, with the header if requested
+    auto format = [&](size_t i, row_writer& writer, bool with_header) {
+        std::map<const var_t*, Var> copies;
+        std::map<std::string, Var> vars;
+        for (const auto& m : ctx->vars) vars[m.first] = copy_var(m.second, copies);
+        for (size_t c = 0; c < plain.size(); ++c) writer.set_plain(c, plain[c]);
+        if (with_header) writer.write(header);
+        std::vector<std::string> row(header.size());
+        std::vector<const val_t*> direct(header.size());
+        binding_t binding;
+        for (auto it = bounds[i]; it != bounds[i + 1]; ++it) {
+            write_entry(writer, vars, it->first, it->second, binding, row, direct);
+        }
+        writer.close();
+    };
+
+    if (shards) {
+        std::vector<std::future<void>> pending;
+        for (size_t i = 0; i < ranges; ++i) {
+            char number[24];
+            sprintf(number, ".%03zu", i);
+            std::vector<std::string> shard_paths;
+            for (const auto& path : paths) {
+                std::string basename, extension;
+                split_extension(path, basename, extension);
+                shard_paths.push_back(basename + number + extension);
+            }
+            pending.push_back(std::async(std::launch::async, [&, i, shard_paths] {
+                std::vector<std::unique_ptr<row_writer>> writers;
+                for (const auto& shard : shard_paths) writers.push_back(row_writer::open(fopen_or_die(shard.c_str(), fmode_writing), shard));
+                tee_writer writer(std::move(writers));
+                format(i, writer, true);
+            }));
+        }
+        for (auto& p : pending) p.get();
+        for (const auto& path : paths) printf("Wrote %zu lines to %zu shards of %s (%zu entries)\n", doc.data.size(), ranges, path.c_str(), doc.data.size());
+        return;
+    }
+
+    // ranges are formatted into memory ahead of the one being written, keeping every job busy
+    std::vector<std::unique_ptr<output_t>> outs;
+    for (const auto& path : paths) outs.push_back(output_t::open(fopen_or_die(path.c_str(), fmode_writing), path, paths.size() > 1));
+    std::deque<std::future<std::string>> pending;
+    size_t dispatched = 0;
+    for (size_t written = 0; written < ranges; ++written) {
+        while (pending.size() <= jobs && dispatched < ranges) {
+            pending.push_back(std::async(std::launch::async, [&](size_t i) {
+                buffer_output* buf = new buffer_output();
+                csv_writer writer((std::unique_ptr<output_t>(buf)));
+                format(i, writer, i == 0);
+                return std::move(buf->buf);
+            }, dispatched++));
+        }
+        std::string block = pending.front().get();
+        pending.pop_front();
+        for (auto& out : outs) out->write(block.data(), block.size());
     }
+    for (auto& out : outs) out->close();
+    for (const auto& path : paths) printf("Wrote %zu lines to %s (%zu entries)\n", doc.data.size(), path.c_str(), doc.data.size());
+}
+
+void document_t::write_single(const document_t& doc, const std::vector<std::string>& labels, const std::vector<std::string>& paths) {
+    bool tables = false;
+    for (const auto& path : paths) tables |= table_path(path);
+    if (ctx->trailing && shards) {
+        // each row holds a key's values for every trailing value, so there is nothing to split
+        fprintf(stderr, "warning: --shards is not supported by formats with a trailing var; writing a single file\n");
+    }
+    if (!ctx->trailing && (shards || (jobs > 1 && doc.data.size() >= 2 * WRITE_BLOCK && !tables))) {
+        write_parallel(doc, paths);
+        return;
+    }
+    // with several outputs, each gets a thread of its own to write on, if there are jobs to spare
+    std::vector<std::unique_ptr<row_writer>> writers;
+    for (const auto& path : paths) writers.push_back(row_writer::open(fopen_or_die(path.c_str(), fmode_writing), path, paths.size() > 1 && jobs > 1));
+    // generate header and trail
+    std::vector<std::string> row = pretrail_header();
+    size_t pretrail = row.size();
 
     if (ctx->trailing) {
         // load each trailing entry from doc context, convert using own context into own format, and then write to trail and row
@@ -275,7 +1096,12 @@ void document_t::write_single(const document_t& doc, FILE* fp) {
         }
     }
 
-    writer.write(row);
+    for (auto& writer : writers) {
+        writer->write(row);
+        for (const auto& var : aligned) {
+            writer->set_plain(var->index, var->plain());
+        }
+    }
 
     size_t count = 0;
 
@@ -301,6 +1127,16 @@ void document_t::write_single(const document_t& doc, FILE* fp) {
 
         int trail_idx = key_indices[ctx->varnames[ctx->trailing]];
 
+        // trailing values are written straight from the source values (nullptr for missing ones),
+        // for each output (i.e. aspect) at once, so the entries are only looked up once
+        std::vector<std::vector<const val_t*>> cells(labels.size(), std::vector<const val_t*>(trail.size()));
+
+        // the vars and the aspects, as bound to the schema of the current entry
+        const std::vector<std::string> names = var_names(ctx->vars);
+        std::vector<Var> named;
+        for (const auto& m : ctx->vars) named.push_back(m.second);
+        binding_t var_binding, label_binding;
+
         // starting point
         group_t g(doc.data.begin()->first);
         // printf("starting point: %s; setting key %s\n", g.to_string().c_str(), ctx->varnames[key].c_str());
@@ -313,23 +1149,25 @@ void document_t::write_single(const document_t& doc, FILE* fp) {
                 row[key->index] = key->write();
             }
             // printf("row[%d] = %s (key->write)\n", key->index, row[key->index].c_str());
-            g.values[idx] = key->imprint(*fitness_set);
+            g.set(idx, key->imprint(*fitness_set));
             // printf("g.values[-'-] = %s\n", g.values[idx]->to_string().c_str());
             // printf("g = %s\n", g.to_string().c_str());
-            size_t rowidx = pretrail;
+            size_t rowidx = 0;
             bool initial = true;
             for (const auto& t : trail) {
                 ctx->trailing->read(t);
                 // we are using our own imprint of the value here (e.g. 2021-01-06), but it's retaining components, so any other format should work fine
                 // e.g. if the incoming doc uses "2021/01/06".
-                g.values[trail_idx] = ctx->trailing->imprint(*fitness_set);
-                if (doc.data.count(g) == 0) {
+                g.set(trail_idx, ctx->trailing->imprint(*fitness_set));
+                auto found = doc.data.find(g);
+                if (found == doc.data.end()) {
                     // this data is missing, so we simply provide a zero value
                     if (!warn_keys.count(key->write())) {
                         warn_keys.insert(key->write());
                         fprintf(stderr, "warning: parts of %s missing\n", key->write().c_str());
                     }
-                    row[rowidx++] = "0";
+                    for (auto& c : cells) c[rowidx] = nullptr;
+                    ++rowidx;
                     // // search for alternatives
                     // for (const std::string& a : g.values[idx]->alternatives) {
                     //     g.values[idx]->set_value(a);
@@ -338,12 +1176,15 @@ void document_t::write_single(const document_t& doc, FILE* fp) {
                     // if (!doc.data.count(g)) throw std::runtime_error("missing data for " + g.to_string());
                     continue;
                 }
-                const auto& valuemap = doc.data.at(g);
+                const auto& valuemap = found->second;
+                var_binding.bind(valuemap, names);
+                label_binding.bind(valuemap, labels);
                 if (initial) {
-                    for (const auto& m : valuemap) {
-                        if (ctx->vars.count(m.first)) {
-                            auto v = ctx->vars.at(m.first);
-                            v->read(*m.second);
+                    for (size_t i = 0; i < named.size(); ++i) {
+                        const val_t* value = valuemap.get(var_binding.slots[i]);
+                        if (value) {
+                            auto v = named[i];
+                            v->read(*value);
                             if (!v->trails) {
                                 row[v->index] = v->write();
                             }
@@ -351,44 +1192,105 @@ void document_t::write_single(const document_t& doc, FILE* fp) {
                     }
                     initial = false;
                 }
-                row[rowidx++] = valuemap.at(aspect)->get_value(); // TODO: deal with conversions
+                for (size_t a = 0; a < labels.size(); ++a) {
+                    const val_t* cell = valuemap.get(label_binding.slots[a]);
+                    if (!cell) throw std::out_of_range("no value for aspect " + labels[a]);
+                    cells[a][rowidx] = cell; // TODO: deal with conversions
+                }
+                ++rowidx;
             }
             // completed one row; phew!
-            writer.write(row);
+            for (size_t a = 0; a < writers.size(); ++a) {
+                for (size_t i = 0; i < pretrail; ++i) writers[a]->field(row[i]);
+                for (const val_t* cell : cells[a]) write_value(*writers[a], cell);
+                writers[a]->end_row();
+            }
             ++count;
         }
-        printf("Wrote %zu lines (%zu entries)\n", count, doc.data.size());
+        for (size_t a = 0; a < writers.size(); ++a) {
+            writers[a]->close();
+            printf("Wrote %zu lines to %s (%zu entries)\n", count, paths[a].c_str(), doc.data.size());
+        }
         return;
     }
 
-    // the simple case: we read each entry as it comes, and writes it out to the disk ordered as described
-
+    // the simple case: we read each entry as it comes, and writes it out to the disk ordered as
+    // described; the rows do not depend on the aspect, so they are formatted once for all outputs
+    std::unique_ptr<row_writer> writer(writers.size() == 1 ? writers[0].release() : new tee_writer(std::move(writers)));
+    // numeric values which are written as is skip the var altogether
+    std::vector<const val_t*> direct(row.size());
+    binding_t binding;
     for (const auto& entry : doc.data) {
-        size_t kiter = 0;
-        for (const auto& m : ctx->vars) {
-            Var v = m.second;
-            if (v->key) {
-                v->read(*entry.first.values.at(kiter++));
-            } else {
-                if (entry.second.count(m.first)) {
-                    v->read(*entry.second.at(m.first));
-                } else {
-                    if (!warn_keys.count(m.first)) {
-                        fprintf(stderr, "Warning: missing value for \"%s\"\n", m.first.c_str());
-                        warn_keys.insert(m.first);
-                    }
-                    v->read("");
+        write_entry(*writer, ctx->vars, entry.first, entry.second, binding, row, direct);
+        ++count;
+    }
+    writer->close();
+    for (const auto& path : paths) printf("Wrote %zu lines to %s (%zu entries)\n", count, path.c_str(), doc.data.size());
+}
+
+void document_t::warn_missing(const std::string& name) {
+    // entries may be written on several threads at once
+    static std::mutex mtx;
+    std::lock_guard<std::mutex> lock(mtx);
+    if (!warn_keys.count(name)) {
+        fprintf(stderr, "Warning: missing value for \"%s\"\n", name.c_str());
+        warn_keys.insert(name);
+    }
+}
+
+std::vector<std::string> document_t::var_names(const std::map<std::string, Var>& vars) {
+    std::vector<std::string> names;
+    for (const auto& m : vars) names.push_back(m.first);
+    return names;
+}
+
+void document_t::write_entry(row_writer& writer, const std::map<std::string, Var>& vars, const group_t& group, const valuemap_t& valuemap, binding_t& binding, std::vector<std::string>& row, std::vector<const val_t*>& direct) {
+    if (binding.schema != valuemap.schema) binding.bind(valuemap, var_names(vars));
+    size_t kiter = 0, i = 0;
+    for (const auto& m : vars) {
+        Var v = m.second;
+        const size_t slot = binding.slots[i++];
+        if (v->key) {
+            v->read(*group.values().at(kiter++));
+        } else {
+            const val_t* value = valuemap.get(slot);
+            if (value) {
+                if (v->index > -1 && v->passthrough() && value->is_number()) {
+                    direct[v->index] = value;
+                    continue;
                 }
+                v->read(*value);
+            } else {
+                warn_missing(m.first);
+                v->read("");
             }
-            if (v->index > -1) row[v->index] = v->write();
         }
-        writer.write(row);
-        ++count;
+        if (v->index > -1) {
+            row[v->index] = v->write();
+            direct[v->index] = nullptr;
+        }
+    }
+    for (size_t i = 0; i < row.size(); ++i) {
+        if (direct[i]) {
+            writer.field(direct[i]->get_number());
+        } else {
+            writer.field(row[i]);
+        }
     }
-    printf("Wrote %zu lines (%zu entries)\n", count, doc.data.size());
+    writer.end_row();
 }
 
-void document_t::save_data_to_disk(const document_t& doc, const std::string& path) {
+std::vector<std::string> document_t::pretrail_header() const {
+    size_t pretrail = values.size() - (ctx->trailing ? 1 : 0);
+    for (const auto& k : keys) pretrail += k->fit.size() == 0;
+    std::vector<std::string> row(pretrail);
+    for (const auto& var : aligned) {
+        row[var->index] = var->str;
+    }
+    return row;
+}
+
+void document_t::align_output() {
     // align based on context list
     int index = 0;
     aligned.clear();
@@ -403,16 +1305,53 @@ void document_t::save_data_to_disk(const document_t& doc, const std::string& pat
     for (const auto& v : ctx->vars) {
         printf("- %s = %s\n", v.first.c_str(), v.second->to_string().c_str());
     }
+}
+
+void document_t::stream_from_disk(document_t& source, const std::vector<std::string>& paths, const std::string& path) {
+    if (source.aggregates.size() > 0 || source.ctx->trailing || source.ctx->aspects.size() > 0 || ctx->trailing || ctx->aspects.size() > 0) {
+        throw std::runtime_error("streaming is only possible for formats without sum(), trailing vars or aspects");
+    }
+    align_output();
+    std::unique_ptr<row_writer> out = row_writer::open(fopen_or_die(path.c_str(), fmode_writing), path);
+    row_writer& writer = *out;
+    std::vector<std::string> row = pretrail_header();
+    writer.write(row);
+    for (const auto& var : aligned) {
+        writer.set_plain(var->index, var->plain());
+    }
+    std::vector<const val_t*> direct(row.size());
+    binding_t binding;
+    size_t count = 0;
+    source.sink = [&](const group_t& group, const valuemap_t& valuemap) {
+        write_entry(writer, ctx->vars, group, valuemap, binding, row, direct);
+        ++count;
+    };
+    source.load_from_disk(paths);
+    source.sink = nullptr;
+    writer.close();
+    printf("Wrote %zu lines\n", count);
+}
+
+void document_t::save_data_to_disk(const document_t& doc, const std::string& path) {
+    align_output();
 
     if (ctx->aspects.size() > 0) {
-        std::string basename = path.length() > 4 && path.substr(path.length() - 4) == ".csv" ? path.substr(0, path.length() - 4) : path;
+        // the aspect goes in front of the extension, e.g. result.csv.gz -> result_confirmed.csv.gz
+        std::string basename, extension;
+        split_extension(path, basename, extension);
+        std::vector<std::string> labels, paths;
         for (size_t i = 0; i < ctx->aspects.size(); ++i) {
             if (ctx->aspects[i].priority == -1) continue;
-            aspect = ctx->aspects[i].label;
-            write_single(doc, fopen_or_die((basename + "_" + aspect + ".csv").c_str(), fmode_writing));
+            labels.push_back(ctx->aspects[i].label);
+            paths.push_back(basename + "_" + labels.back() + extension);
+        }
+        // every aspect is written in one go
+        if (labels.size() > 0) {
+            write_single(doc, labels, paths);
+            aspect = labels.back();
         }
     } else {
-        write_single(doc, fopen_or_die(path.c_str(), fmode_writing));
+        write_single(doc, { aspect }, { path });
     }
 }
 
@@ -423,12 +1362,34 @@ void document_t::save_data_to_disk(const std::string& path) {
 void document_t::create_index(size_t group_index, std::set<val_t>& dest, Var formatter) const {
     dest.clear();
     for (const auto& entry : data) {
-        formatter->read(*entry.first.values.at(group_index));
+        formatter->read(*entry.first.values().at(group_index));
         dest.insert(*formatter->imprint(*fitness_set));
     }
 }
 
+string_pool_t::stats_t document_t::interned() const {
+    string_pool_t::stats_t total = streamed;
+    total += val_t::interned(arena.get());
+    for (const auto& a : borrowed) total += val_t::interned(a.get());
+    if (scratch) total += val_t::interned(scratch.get());
+    return total;
+}
+
+void document_t::borrow(const document_t& other) {
+    std::vector<std::shared_ptr<arena_t>> arenas(other.borrowed);
+    arenas.push_back(other.arena);
+    for (const auto& a : arenas) {
+        if (a != arena && std::find(borrowed.begin(), borrowed.end(), a) == borrowed.end()) borrowed.push_back(a);
+    }
+    std::vector<std::shared_ptr<key_dictionary_t>> others(other.borrowed_dictionaries);
+    others.push_back(other.dictionaries);
+    for (const auto& d : others) {
+        if (d && d != dictionaries && std::find(borrowed_dictionaries.begin(), borrowed_dictionaries.end(), d) == borrowed_dictionaries.end()) borrowed_dictionaries.push_back(d);
+    }
+}
+
 void document_t::import_data(const std::vector<Document>& sources, import_mode mode, const std::string& import_param) {
+    for (const auto& source : sources) borrow(*source);
     switch (mode) {
     case import_mode::replace:
         if (sources.size() != 1) throw std::runtime_error("replace mode only works with single sources");
@@ -466,16 +1427,21 @@ void document_t::import_data(const std::vector<Document>& sources, import_mode m
         {
             size_t divisor = sources.size();
             std::set<std::string> numeric;
-            for (const auto& m : sources[0]->data.begin()->second) {
-                if (m.second->is_number()) numeric.insert(m.first);
+            const valuemap_t& first = sources[0]->data.begin()->second;
+            for (size_t slot = 0; slot < first.values.size(); ++slot) {
+                if (first.values[slot] && first.values[slot]->is_number()) numeric.insert(first.schema->names[slot]);
             }
             for (const auto& doc : sources) {
-                for (const auto& m : doc->data.begin()->second) {
-                    if (!m.second->is_number() && numeric.count(m.first)) {
-                        numeric.erase(m.first);
-                    }
+                const valuemap_t& vm = doc->data.begin()->second;
+                for (size_t slot = 0; slot < vm.values.size(); ++slot) {
+                    if (vm.values[slot] && !vm.values[slot]->is_number()) numeric.erase(vm.schema->names[slot]);
                 }
             }
+            // the numeric values, by slot in the schema of each source
+            const std::vector<std::string> names(numeric.begin(), numeric.end());
+            std::vector<binding_t> bindings(sources.size());
+            for (size_t i = 0; i < sources.size(); ++i) bindings[i].bind(sources[i]->data.begin()->second, names);
+            binding_t own;
 
             std::set<group_t> known;
             for (auto it = sources.rbegin(); it != sources.rend(); ++it) {
@@ -483,14 +1449,18 @@ void document_t::import_data(const std::vector<Document>& sources, import_mode m
                 for (const auto& k : d->data) {
                     if (!known.count(k.first)) {
                         data[k.first] = k.second;
-                        std::map<std::string, Value>& vm = data[k.first];
-                        for (const std::string& num : numeric) {
+                        valuemap_t& vm = data[k.first];
+                        own.bind(vm, names);
+                        for (size_t n = 0; n < names.size(); ++n) {
                             // only support integers atm
                             int64_t i = 0;
-                            for (const auto& d : sources) {
-                                i += d->data.at(k.first).at(num)->get_number();
+                            for (size_t s = 0; s < sources.size(); ++s) {
+                                const val_t* v = sources[s]->data.at(k.first).get(bindings[s].slots[n]);
+                                if (!v) throw std::out_of_range("missing value " + names[n]);
+                                i += v->get_number();
                             }
-                            vm[num]->set_number(i / divisor);
+                            if (!vm.get(own.slots[n])) throw std::out_of_range("missing value " + names[n]);
+                            vm[own.slots[n]]->set_number(i / divisor);
                         }
                         data[k.first] = k.second;
                         known.insert(k.first);
@@ -510,9 +1480,9 @@ void document_t::import_data(const std::vector<Document>& sources, import_mode m
             if (sources.back()->key_indices.count(import_param) == 0) throw std::runtime_error("invalid import parameter (key not found in source(s))");
             size_t param_indice = sources.back()->key_indices[import_param];
             data = sources[0]->data;
-            val_t highest = *data.begin()->first.values[param_indice];
+            val_t highest = *data.begin()->first.values()[param_indice];
             for (const auto& k : data) {
-                const auto& v = k.first.values.at(param_indice);
+                const auto& v = k.first.values().at(param_indice);
                 if (highest < *v) highest = *v;
             }
             // now iterate in order and update the "highest" criteria for each new doc
@@ -520,7 +1490,7 @@ void document_t::import_data(const std::vector<Document>& sources, import_mode m
                 Document doc = *it;
                 val_t next = highest;
                 for (const auto& k : doc->data) {
-                    const auto& v = k.first.values.at(param_indice);
+                    const auto& v = k.first.values().at(param_indice);
                     if (highest < *v) {
                         data[k.first] = k.second;
                         if (next < *v) next = *v;
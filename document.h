@@ -1,20 +1,106 @@
 #ifndef included_document_h_
 #define included_document_h_
 
+#include <functional>
 #include <set>
 #include <memory>
 
+#include "arena.h"
 #include "env.h"
+#include "dictionary.h"
 #include "utils.h"
+#include "parser/csv.h"
+#include "parser/table.h"
 
-struct group_t {
-    std::vector<Value> values;
+// values kept in an arena (see arena_t), such as those of entries
+typedef std::vector<Value, arena_allocator<Value>> values_t;
+
+/**
+ * The key of an entry: its key values, each along with its code in the dictionary of its column
+ * (see key_dictionary_t). Keys encoded in the same dictionaries are ordered by their codes alone;
+ * the codes of the common 2 and 3 key arities are kept inline, and compared unrolled. Other keys,
+ * such as those of other documents and those only made to look entries up, are ordered by their
+ * values, which is the same order.
+ */
+class group_t {
+public:
+    group_t(arena_t* arena = nullptr, const key_dictionary_t* dictionaries_in = nullptr) : _values(arena), spilled_codes(arena), dictionaries(dictionaries_in) {}
+    void reserve(size_t arity) { _values.reserve(arity); }
+    // push v, to a key without dictionaries
+    void push_back(const Value& v) { _values.push_back(v); }
+    // push v, whose code in the dictionary of its column is code
+    void push_back(const Value& v, uint32_t code);
+    // replace the value at index with v, which is not encoded, so that the key is then ordered by
+    // its values
+    void set(size_t index, const Value& v);
+    size_t size() const { return _values.size(); }
+    const values_t& values() const { return _values; }
     bool operator<(const group_t& other) const;
     std::string to_string() const;
     group_t iterate(size_t index, Value v) const;
     group_t exclude(size_t index) const;
+private:
+    static const size_t INLINE = 3;
+    values_t _values;
+    uint32_t inline_codes[INLINE]{};
+    std::vector<uint32_t, arena_allocator<uint32_t>> spilled_codes; // all codes, once there are more than INLINE
+    const key_dictionary_t* dictionaries; // of each column, or null if the key is not encoded
+    const uint32_t* codes() const { return size() > INLINE ? spilled_codes.data() : inline_codes; }
+};
+
+/**
+ * The names of the values an entry can hold, each at a slot of its own. A document binds the names
+ * of its values and aspects to slots when it is created, and deals in slots only after that.
+ * Schemas are never freed, as entries copied into other documents keep referring to the schema of
+ * the document that recorded them.
+ */
+struct schema_t {
+    static const size_t npos = size_t(-1);
+    std::vector<std::string> names;
+    std::map<std::string, size_t> slots;
+    // the slot of name, which is added if new
+    size_t bind(const std::string& name);
+    // the slot of name, or npos if there is none
+    size_t find(const std::string& name) const;
+};
+
+/**
+ * The values of an entry, by slot in its schema; null for values the entry does not have.
+ */
+struct valuemap_t {
+    const schema_t* schema{nullptr};
+    values_t values;
+    valuemap_t(const schema_t* schema_in = nullptr, arena_t* arena = nullptr) : schema(schema_in), values(schema_in ? schema_in->names.size() : 0, nullptr, arena) {}
+    Value& operator[](size_t slot) {
+        if (slot >= values.size()) values.resize(slot + 1);
+        return values[slot];
+    }
+    // the value at slot, or null
+    const val_t* get(size_t slot) const { return slot < values.size() ? values[slot].get() : nullptr; }
+};
+
+/**
+ * The slots in one schema of a list of names; entries of several documents may end up in the
+ * same data, so bindings are redone whenever an entry with another schema comes along.
+ */
+struct binding_t {
+    const schema_t* schema{nullptr};
+    std::vector<size_t> slots;
+    // bind names to the schema of valuemap, unless they already are
+    void bind(const valuemap_t& valuemap, const std::vector<std::string>& names) {
+        if (schema == valuemap.schema) return;
+        schema = valuemap.schema;
+        slots.clear();
+        for (const auto& name : names) slots.push_back(schema->find(name));
+    }
 };
 
+/**
+ * The entries of a document. Their nodes, keys, value maps and values are all made in arenas, so
+ * that data can simply be left behind when the document goes, rather than destroyed entry by entry.
+ */
+typedef std::map<group_t, valuemap_t, std::less<group_t>, arena_allocator<std::pair<const group_t, valuemap_t>>> data_t;
+
 enum class import_mode {
     /**
      * Clear out the destination data before importing the source data, only changing formatting.
@@ -47,24 +133,59 @@ typedef std::shared_ptr<document_t> Document;
 
 class document_t {
 public:
-    std::map<group_t, std::map<std::string, Value>> data;
+    /**
+     * The arena the document makes its entries in, and the arenas of the documents whose entries
+     * it holds as well, i.e. those of the files it loaded concurrently and of the sources it
+     * imported, which must live as long as it does.
+     */
+    std::shared_ptr<arena_t> arena{std::make_shared<arena_t>()};
+    std::vector<std::shared_ptr<arena_t>> borrowed;
+    /**
+     * The dictionaries of the key columns of the document, which its entries are encoded in, and
+     * those of the documents whose entries it holds as well, which must live as long as it does.
+     */
+    std::shared_ptr<key_dictionary_t> dictionaries;
+    std::vector<std::shared_ptr<key_dictionary_t>> borrowed_dictionaries;
+    // the entries, which live in the arena, and are released along with it in one go
+    data_t& data{*arena->make<data_t>(arena.get())};
     std::string aspect;
 
     std::string cmf_path;
 
-    document_t(Context ctx_in, std::set<std::string>* fitness_set_in = nullptr) : fitness_set(fitness_set_in ?: new std::set<std::string>()), ctx(ctx_in) {}
+    // number of threads to use when loading large inputs
+    size_t jobs{1};
+    // how uncompressed input files are read
+    io_mode io{io_mode::mmap};
+    // directory holding snapshots of loaded documents, if any
+    std::string cache_dir;
+    // write the output as one numbered file per job, rather than a single file
+    bool shards{false};
+
+    document_t(Context ctx_in, std::set<std::string>* fitness_set_in = nullptr) : fitness_set(fitness_set_in ?: new std::set<std::string>()), ctx(ctx_in), schema(new schema_t()) {}
     document_t(const char* path, std::set<std::string>* fitness_set_in = nullptr);
-    document_t() : ctx(nullptr) {}
+    document_t() : ctx(nullptr), schema(new schema_t()) {}
+    // copies would share the data in the arena
+    document_t(const document_t&) = delete;
+    document_t& operator=(const document_t&) = delete;
 
     // align var names to header indices in a document (e.g. a CSV file's first line)
     void align(const std::vector<std::string>& headers);
 
     // process and update data
-    void process(const std::vector<std::string>& row);
+    void process(const csv_row_t& row);
 
     void record_state(const Value& aspect_value = nullptr);
 
     void load_from_disk(cliargs& argiter);
+    void load_from_disk(const std::vector<std::string>& paths);
+    /**
+     * Load each of documents from its paths. With jobs, their files are loaded concurrently; the
+     * result, including the decisions of the fitness set they share, is identical to loading them
+     * one after the other.
+     */
+    static void load_from_disk(const std::vector<Document>& documents, const std::vector<std::vector<std::string>>& paths);
+    // the paths of the input files of the document, taken from argiter: one per aspect (or just one)
+    std::vector<std::string> input_paths(cliargs& argiter) const;
 
     void import_data(const std::vector<Document>& sources, import_mode mode = import_mode::replace, const std::string& import_param = "");
 
@@ -72,12 +193,30 @@ public:
 
     void save_data_to_disk(const document_t& doc, const std::string& path);
 
+    /**
+     * Load the source document's data from paths, writing each entry straight to path in this
+     * document's format instead of keeping it, i.e. a replace import using constant memory.
+     * Entries are written in input order, and are not merged. Only possible when neither format
+     * has sum() aggregates, a trailing var or aspects.
+     */
+    void stream_from_disk(document_t& source, const std::vector<std::string>& paths, const std::string& path);
+
+    // the text interned by the values of the document, including those of the arenas it borrowed
+    string_pool_t::stats_t interned() const;
+
     mutable std::set<std::string>* fitness_set{nullptr};
 private:
-    uint8_t phase{0};
+    uint32_t phase{0};
     Context ctx;
     std::vector<Var> keys, values, aligned, aggregates;
     std::vector<std::string> missing; // these are set to the value "0" for all value maps
+    schema_t* schema;
+    // the slots of the missing values, the aggregates, the values and the aspect source
+    std::vector<size_t> missing_slots, aggregate_slots, value_slots;
+    size_t source_slot{schema_t::npos};
+    // the slot of the aspect of the file being loaded, if any
+    size_t aspect_slot{schema_t::npos};
+    void bind_aspect() { aspect_slot = aspect == "" ? schema_t::npos : schema->bind(aspect); }
     std::map<std::string, int> key_indices;
     std::set<std::string> warn_keys;
     /**
@@ -91,10 +230,128 @@ private:
      * As such, for data with a preferred-if-present column, a fit over this column and the less-good
      * alternative is also possible.
      */
+    // the codes of the keys recorded on the thread loading the document
+    key_encoder_t encoder;
+    // when set, entries are handed to the sink rather than recorded in data, and their keys are
+    // not encoded
+    std::function<void(const group_t&, const valuemap_t&)> sink;
+    // when streaming, the arena rows are made in, which is replaced every STREAM_ROWS rows, and the
+    // text interned by the arenas it replaced
+    std::shared_ptr<arena_t> scratch;
+    size_t scratch_rows{0};
+    string_pool_t::stats_t streamed;
+    static const size_t STREAM_ROWS = 1 << 12;
+    arena_t* stream_arena();
+    /**
+     * Rows (or with a trailing var, cells) as record_state() would record them, imprinted ahead of
+     * time, e.g. on another thread. The versions of fit values are not picked until a row is
+     * committed, as that depends on the fitness set, and so on everything committed before it.
+     */
+    struct staging_t {
+        size_t stride{0};               // values per row: keys, then aggregates, then values
+        arena_t* arena{nullptr};        // of the document staging the rows; entries are made in it too
+        std::vector<Value> vals;        // null for fit values
+        std::vector<Value> aspect_values;
+        std::vector<uint32_t> phases;
+        std::vector<std::pair<size_t, mutable_val_t>> pending; // the fit values, by index in vals
+        // filled in by group(): the codes of the keys of each row, the rows ordered by key (rows
+        // with identical keys in the order they were read), and the entries they make up, as the
+        // position of their first row and valuemap
+        std::vector<uint32_t> codes;
+        std::vector<uint32_t> order;
+        std::vector<std::pair<size_t, valuemap_t>> entries;
+        size_t rows() const { return phases.size(); }
+        Value take(size_t index, std::set<std::string>& fitness_set);
+    };
+    // when set, rows are staged here rather than recorded in data
+    staging_t* staging{nullptr};
+    // keep the arenas and dictionaries of other, whose entries this document now holds as well
+    void borrow(const document_t& other);
+    // record an entry, given the value of the var at each slot (keys, then aggregates, then values)
+    template<typename F> void record(const Value& aspect_value, F value);
+    // record the value of each var of an entry in its valuemap, which existed before or was just
+    // created, with the aspect value at slot label (if not npos); values it makes go in arena
+    template<typename F> void apply(valuemap_t& valuemap, bool existed, size_t label, uint32_t curr_phase, const Value& aspect_value, arena_t* arena, F value) const;
+    // record the staged rows, exactly as they would have been recorded when they were read
+    void commit(staging_t& staged);
+    // resolve the fit values among the keys and aggregates of the staged rows, in order
+    void resolve_keys(staging_t& staged);
+    // order the (resolved) staged rows by key, and record the entries they make up on their own
+    void group(staging_t& staged, size_t label, uint32_t base) const;
+    // record the grouped rows, with the same result as commit()
+    void merge(staging_t& staged, size_t label);
     std::vector<std::string> trail; // for formats with a trail (header contains e.g. dates in a trail going right), this contains the header values
 
+    // load a single CSV file, or every CSV file in a directory, in name order
+    void load_path(const char* path);
     void load_single(FILE* fp);
-    void write_single(const document_t& doc, FILE* fp);
+    void load_batch(const std::vector<std::string>& paths);
+    // the aspect of each of the input files of the document
+    std::vector<std::string> input_labels() const;
+    struct load_t {
+        document_t* doc;
+        std::string path;
+        std::string label;
+    };
+    /**
+     * Load files into their documents concurrently: each is staged by a document of its own on a
+     * thread of its own, at most jobs at a time. Fit values are resolved file by file, in order,
+     * against the shared fitness set, after which each document merges its files on its own. The
+     * result is identical to loading the files one after the other.
+     */
+    static void load_concurrently(const std::vector<load_t>& loads, size_t jobs);
+    // read the header and rows of a CSV file, returning the number of rows
+    size_t load_rows(csv_reader& reader, bool verbose);
+    void load_header(csv_reader& reader, bool verbose);
+    // load the rows of a table written by a table_writer, returning the number of rows
+    size_t load_table(const table_reader& table, bool verbose);
+    size_t load_body(csv_reader& reader);
+    /**
+     * A single, uncompressed input file which is only ever appended to. Its snapshots record how
+     * much of it was loaded and a hash of those bytes, rather than the identity of the file, so
+     * that rows appended to it since can be loaded on top of the restored data.
+     */
+    struct tail_t {
+        std::string path;           // empty if the input is not tailable
+        uint64_t offset{0};         // number of bytes loaded
+        uint64_t prefix{0};         // hash of the bytes loaded
+        bool terminated{false};     // whether the bytes loaded end with a newline
+    };
+    // load the rows appended to the tail file since it was last loaded; false if there are none
+    bool load_tail(tail_t& tail);
+    /**
+     * Snapshots hold the data loaded from a set of input files, along with the fitness set entries
+     * added while loading it. They are stored in a slot named after the formula and input paths,
+     * and keyed on the formula contents, the identity (inode, size, mtime) of each input file, and
+     * the fitness set prior to loading, so that a snapshot is only ever restored in exactly the
+     * situation it was taken in. A changed input or formula simply gets its slot overwritten.
+     * Tailable inputs are keyed on their loaded prefix instead (see tail_t).
+     */
+    bool snapshot_slot(const std::vector<std::string>& paths, const std::vector<std::string>& labels, std::string& slot, uint64_t& key, tail_t& tail) const;
+    bool restore_snapshot(const std::string& slot, uint64_t key, tail_t& tail);
+    void store_snapshot(const std::string& slot, uint64_t key, const std::set<std::string>& known, const tail_t& tail) const;
+    /**
+     * Write the entries of doc to paths, which hold the output for each of the aspects in labels
+     * (or, without aspects, the output for the current aspect). All outputs are written in a single
+     * pass over the entries.
+     */
+    void write_single(const document_t& doc, const std::vector<std::string>& labels, const std::vector<std::string>& paths);
+    /**
+     * Write the entries of doc using jobs threads, each formatting a contiguous range of entries
+     * with its own copy of the vars. The ranges are either written out in order to each of paths,
+     * or, with shards set, each to numbered files of their own. Not possible with a trailing var.
+     */
+    void write_parallel(const document_t& doc, const std::vector<std::string>& paths);
+    // write an entry, with the values of the non-key vars at the slots of their names in binding
+    void write_entry(row_writer& writer, const std::map<std::string, Var>& vars, const group_t& group, const valuemap_t& valuemap, binding_t& binding, std::vector<std::string>& row, std::vector<const val_t*>& direct);
+    // the names of the vars, as bound by write_entry()
+    static std::vector<std::string> var_names(const std::map<std::string, Var>& vars);
+    // warn about a value missing from the source document, once per value name
+    void warn_missing(const std::string& name);
+    // the header of the columns preceding the trail (i.e. all of them, if there is no trailing var)
+    std::vector<std::string> pretrail_header() const;
+    // assign output column indices to the vars of the context
+    void align_output();
 
     void create_index(size_t group_index, std::set<val_t>& dest, Var formatter) const;
 };
@@ -104,7 +361,10 @@ Context CompileCMF(FILE* fp);
 constexpr bool fmode_reading = true;
 constexpr bool fmode_writing = false;
 
+// "-" opens stdin or stdout
 FILE* fopen_or_die(const char* fname, bool reading);
+// reserve stdout for CSV output, sending anything else printed there to stderr
+void claim_stdout();
 
 inline import_mode parse_import_mode(const std::string& mode) {
     if (mode == "replace") return import_mode::replace;
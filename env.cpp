@@ -1,8 +1,14 @@
+#include <algorithm>
+#include <cstring>
+#include <mutex>
 #include <stdexcept>
 #include <set>
+#include <unordered_set>
 
 #include "env.h"
 #include "utils.h"
+#include "cache.h"
+#include "parser/number.h"
 
 using parser::token_type;
 
@@ -51,6 +57,7 @@ ref env_t::scanf(const std::string& input, const std::string& fmt, const std::ve
     Var tmp = std::make_shared<var_t>(input);
     tmp->fmt = fmt;
     tmp->varnames = varnames;
+    tmp->layout = layout_t::of(varnames);
     return ctx->temps.pass(tmp);
 }
 
@@ -122,16 +129,29 @@ template<typename T> static inline void set_insert_array(std::set<T>& set, T* ar
 }
 
 void var_t::read(const std::string& input_string) {
-    value = input_string;
+    read(input_string.data(), input_string.size());
+}
 
-    if (exceptions.count(value)) value = exceptions[value];
+void var_t::read(const char* input, size_t len) {
+    numbered = false;
+    value.assign(input, len);
+
+    // the input is not necessarily null terminated, so we scan from value, unless an exception
+    // replaces it, in which case we hold on to a copy of the original
+    std::string replaced;
+    bool is_replaced = exceptions.size() > 0 && exceptions.count(value);
+    if (is_replaced) {
+        replaced = value;
+        value = exceptions[value];
+    }
+    const std::string& input_string = is_replaced ? replaced : value;
 
     if (fit.size() > 0) {
         const char* ch = input_string.data();
         size_t s = 0, p = 0;
         for (size_t i = 0; i < fit.size(); ++i) {
             while (input_string[p] && input_string[p] != '|') ++p;
-            fit[i]->read(std::string(&ch[s], &ch[p]));
+            fit[i]->read(&ch[s], p - s);
             ++p;
         }
         return;
@@ -139,22 +159,29 @@ void var_t::read(const std::string& input_string) {
 
     if (fmt == "") return;
 
-    static std::set<char>* u_set = nullptr;
-    static std::set<char>* s_set = nullptr;
-    if (!u_set) {
-        u_set = new std::set<char>();
-        s_set = new std::set<char>();
-        set_insert_range(*u_set, '0', '9');
-        set_insert_range(*s_set, '0', '9');
-        set_insert_range(*s_set, 'a', 'z');
-        set_insert_range(*s_set, 'A', 'Z');
-        set_insert_array(*s_set, (char*)",./:;!@#$%^&*()-=_+[]\\{}|", 26);
-    }
+    // vars may be read on several threads at once, so these are built by (thread safe) static
+    // initialization rather than on first use
+    static std::set<char>* const u_set = [] {
+        std::set<char>* set = new std::set<char>();
+        set_insert_range(*set, '0', '9');
+        return set;
+    }();
+    static std::set<char>* const s_set = [] {
+        std::set<char>* set = new std::set<char>();
+        set_insert_range(*set, '0', '9');
+        set_insert_range(*set, 'a', 'z');
+        set_insert_range(*set, 'A', 'Z');
+        set_insert_array(*set, (char*)",./:;!@#$%^&*()-=_+[]\\{}|", 26);
+        return set;
+    }();
 
     size_t varnamepos = 0;
     bool fmtflag = false;
     const char* pos = input_string.data();
-    char buf[128];
+    // the components, back to back in the order they are scanned
+    char scanned[layout_t::MAX_COMPONENTS * 128];
+    size_t lengths[layout_t::MAX_COMPONENTS];
+    char* buf = scanned;
     std::set<char>* set;
     bool decimal = false;
 
@@ -175,8 +202,9 @@ void var_t::read(const std::string& input_string) {
             if (!scan(*set, stopper, pos, buf, decimal)) {
                 throw std::runtime_error(std::string("failed to scan %") + ch + " from input " + input_string.data() + " near " + pos);
             }
-            comps[varnames[varnamepos++].label] = buf;
-            if (varnamepos == varnames.size()) return;
+            lengths[varnamepos] = strlen(buf);
+            buf += lengths[varnamepos++];
+            if (varnamepos == varnames.size()) break;
             fmtflag = false;
         } else if (ch == '%') {
             fmtflag = true;
@@ -187,55 +215,97 @@ void var_t::read(const std::string& input_string) {
     }
 
     if (varnamepos < varnames.size()) throw std::runtime_error("input ended before scanning variable " + varnames[varnamepos].label + " in " + input_string + " for format " + fmt);
+    comps.pack(layout, scanned, lengths);
+}
+
+Value var_t::imprint(std::set<std::string>& fitness_set, arena_t* arena) const {
+    mutable_val_t val = stage();
+    if (fit.size() > 0) resolve(val, fitness_set);
+    return make_value(arena, val);
 }
 
-Value var_t::imprint(std::set<std::string>& fitness_set) const {
+mutable_val_t var_t::stage() const {
     mutable_val_t val;
+    if (numbered) {
+        // numbers keep no text
+        val.numeric = true;
+        val.number = number;
+        return val;
+    }
     val.value = value;
-    val.numeric = is_numeric(value.c_str());
-    if (fmt.size() > 0) {
-        val.comps.clear();
-        for (size_t i = 0; i < varnames.size(); ++i) {
-            val.comps[varnames[i].label] = prioritized_t(comps.at(varnames[i].label), varnames.at(i).priority);
-        }
+    // numeric cells are converted right away, so that they are never parsed again
+    val.numeric = number::parse(value.data(), value.size(), val.number);
+    if (fmt.size() > 0 && varnames.size() > 0) {
+        if (comps.empty()) throw std::runtime_error("components of " + str + " were never scanned");
+        val.comps = comps;
     }
     if (fit.size() > 0) {
-        std::vector<std::string> versions;
-        for (const auto& f : fit) versions.push_back(f->write());
-        size_t i = 0, first = 0;
-        for (; i < versions.size(); ++i) {
-            if (versions[i] == "") {
-                first += first == i;
-                continue;
-            }
-            if (fitness_set.count(versions[i])) {
-                break;
-            }
+        val.value = fit[0]->write();
+        for (size_t i = 1; i < fit.size(); ++i) val.alternatives.push_back(fit[i]->write());
+        if (val.numeric) val.number = val_t::to_int64(val.value);
+    }
+    return val;
+}
+
+void var_t::resolve(mutable_val_t& val, std::set<std::string>& fitness_set) {
+    std::vector<std::string> versions;
+    versions.push_back(val.value);
+    versions.insert(versions.end(), val.alternatives.begin(), val.alternatives.end());
+    size_t i = 0, first = 0;
+    for (; i < versions.size(); ++i) {
+        if (versions[i] == "") {
+            first += first == i;
+            continue;
         }
-        if (i == versions.size()) {
-            // insert
-            fitness_set.insert(versions[first]);
-            i = first;
+        if (fitness_set.count(versions[i])) {
+            break;
         }
-        val.value = versions[i];
-        versions.erase(versions.begin() + i);
-        val.alternatives = versions;
     }
-    return std::make_shared<val_t>(val);
+    if (i == versions.size()) {
+        // insert
+        fitness_set.insert(versions[first]);
+        i = first;
+    }
+    val.value = versions[i];
+    if (val.numeric) val.number = val_t::to_int64(val.value);
+    versions.erase(versions.begin() + i);
+    val.alternatives = versions;
 }
 
 void var_t::read(const val_t& val) {
-    const auto& val_comps = val.get_comps();
-    if (val_comps.size() > 0) {
-        comps.clear();
-        for (size_t i = 0; i < varnames.size(); ++i) {
-            comps[varnames[i].label] = val_comps.at(varnames[i].label).label;
+    numbered = false;
+    const comps_t& val_comps = val.get_comps();
+    if (!val_comps.empty()) {
+        if (val_comps.layout == layout) {
+            comps = val_comps;
+        } else {
+            // another format (e.g. "%u/%u/%u" rather than "%u-%u-%u"): the components are matched
+            // by name once, and repacked in this layout
+            if (read_layout != val_comps.layout) {
+                read_positions.clear();
+                for (const auto& name : layout->names) {
+                    const auto& names = val_comps.layout->names;
+                    size_t at = std::find(names.begin(), names.end(), name) - names.begin();
+                    if (at == names.size()) throw std::runtime_error("missing component " + name + " for " + str);
+                    read_positions.push_back(at);
+                }
+                read_layout = val_comps.layout;
+            }
+            char scanned[layout_t::MAX_COMPONENTS * 128];
+            size_t lengths[layout_t::MAX_COMPONENTS];
+            char* buf = scanned;
+            for (size_t i = 0; i < read_positions.size(); ++i) {
+                const char* text = val_comps.component(read_positions[i], lengths[i]);
+                memcpy(buf, text, lengths[i]);
+                buf += lengths[i];
+            }
+            comps.pack(layout, scanned, lengths);
         }
         value = write();
     } else if (fit.size() > 0) {
         std::vector<std::string> versions;
         versions.push_back(val.get_value());
-        versions.insert(versions.end(), val.alternatives.begin(), val.alternatives.end());
+        versions.insert(versions.end(), val.get_alternatives().begin(), val.get_alternatives().end());
         if (versions.size() != fit.size()) throw std::runtime_error("fit error (" + std::to_string(versions.size()) + " != " + std::to_string(fit.size()) + ")");
         // alternatives.clear();
         for (size_t i = 0; i < fit.size(); ++i) {
@@ -261,7 +331,10 @@ std::string var_t::write() const {
                 if (ch == '%') {
                     rv += '%';
                 } else {
-                    rv += comps.at(varnames.at(varnamepos++).label);
+                    if (varnamepos >= comps.size()) throw std::runtime_error("missing component " + std::to_string(varnamepos) + " of " + str);
+                    size_t len;
+                    const char* text = comps.component(varnamepos++, len);
+                    rv.append(text, len);
                 }
                 fmtflag = false;
             } else if (ch == '%') {
@@ -278,7 +351,12 @@ std::string var_t::write() const {
         rv += "}";
         return rv;
     }
-    return value;
+    return numbered ? std::to_string(number) : value;
+}
+
+bool var_t::plain() const {
+    if (fmt.size() == 0 || fit.size() > 0 || exceptions.size() > 0) return false;
+    return fmt.find(',') == std::string::npos && fmt.find("%s") == std::string::npos;
 }
 
 std::string var_t::to_string() const {
@@ -296,7 +374,7 @@ std::string var_t::to_string() const {
         return s + "}" + suffix;
     }
     if (fmt == "") return str + suffix;
-    if (comps.size() == 0) {
+    if (comps.empty()) {
         return str + " (" + std::to_string(varnames.size()) + " component scanned)" + suffix;
     }
     return str + "(" + write() + ")" + suffix;
@@ -306,14 +384,141 @@ bool var_t::operator<(const var_t& other) const {
     return other.write() < write();
 }
 
+const layout_t* layout_t::of(const std::vector<prioritized_t>& varnames) {
+    if (varnames.size() > MAX_COMPONENTS) throw std::runtime_error("too many components (" + std::to_string(varnames.size()) + " > " + std::to_string(MAX_COMPONENTS) + ")");
+    layout_t layout;
+    // priorities are normally 0, 1, 2 and so on; components with the same one (such as those
+    // declared without any) are compared in the order they are scanned
+    std::vector<size_t> order(varnames.size());
+    for (size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return varnames[a].priority < varnames[b].priority; });
+    layout.rank.resize(varnames.size());
+    for (size_t r = 0; r < order.size(); ++r) layout.rank[order[r]] = r;
+    for (const auto& v : varnames) layout.names.push_back(v.label);
+
+    static std::mutex mtx;
+    static std::map<std::pair<std::vector<std::string>, std::vector<uint8_t>>, const layout_t*> layouts;
+    std::lock_guard<std::mutex> lock(mtx);
+    const layout_t*& known = layouts[std::make_pair(layout.names, layout.rank)];
+    if (!known) known = new layout_t(layout);
+    return known;
+}
+
+void comps_t::pack(const layout_t* layout_in, const char* scanned, const size_t* lengths) {
+    layout = layout_in;
+    const size_t n = layout->names.size();
+    // where each component starts in scanned, by rank
+    const char* starts[layout_t::MAX_COMPONENTS];
+    size_t sizes[layout_t::MAX_COMPONENTS];
+    for (size_t i = 0; i < n; ++i) {
+        starts[layout->rank[i]] = scanned;
+        sizes[layout->rank[i]] = lengths[i];
+        scanned += lengths[i];
+    }
+    text.clear();
+    for (size_t r = 0; r < n; ++r) {
+        text.append(starts[r], sizes[r]);
+        ends[r] = text.size();
+    }
+}
+
+struct extra_hash_t {
+    size_t operator()(const val_t::extra_t& e) const {
+        hasher_t h;
+        h.add_u64(uintptr_t(e.text));
+        h.add_u64(uintptr_t(e.comps.layout));
+        h.add(e.comps.text);
+        for (const auto& a : e.alternatives) h.add(a);
+        return h.h;
+    }
+};
+struct extra_equal_t {
+    bool operator()(const val_t::extra_t& a, const val_t::extra_t& b) const {
+        if (a.text != b.text || a.comps.layout != b.comps.layout || a.comps.text != b.comps.text || a.alternatives != b.alternatives) return false;
+        for (size_t i = 0; i < a.comps.size(); ++i) if (a.comps.ends[i] != b.comps.ends[i]) return false;
+        return true;
+    }
+};
+// the pools of the text and the rare parts of values
+struct value_pools_t {
+    string_pool_t strings;
+    // elements of an unordered_set stay where they are when it grows
+    std::unordered_set<val_t::extra_t, extra_hash_t, extra_equal_t> extras;
+};
+// the pools of the values made outside of arenas, which may be made on any thread
+static std::mutex shared_mtx;
+static value_pools_t shared_pools;
+static value_pools_t& pools_of(arena_t* arena) {
+    if (!arena) return shared_pools;
+    if (!arena->pools) arena->pools = std::make_shared<value_pools_t>();
+    return *(value_pools_t*)arena->pools.get();
+}
+
+void val_t::assign(const std::string& value, const comps_t& comps, const std::vector<std::string>& alternatives, arena_t* arena) {
+    std::unique_lock<std::mutex> lock;
+    if (!arena) lock = std::unique_lock<std::mutex>(shared_mtx);
+    value_pools_t& pools = pools_of(arena);
+    if (!comps.empty() || alternatives.size() > 0) {
+        const extra_t* extra = &*pools.extras.insert(extra_t{pools.strings.intern(value), comps, alternatives}).first;
+        _value = uintptr_t(extra) | 1;
+    } else {
+        // the text of numbers is made from the number, when asked for
+        _value = numeric ? 0 : uintptr_t(pools.strings.intern(value));
+    }
+    if (numeric) return;
+    size_t len;
+    const uint8_t* bytes = ordered(len);
+    uint64_t p = 0;
+    for (size_t i = 0; i < 8; ++i) p = (p << 8) | (i < len ? bytes[i] : 0);
+    number = p;
+}
+
+string_pool_t::stats_t val_t::interned(arena_t* arena) {
+    std::unique_lock<std::mutex> lock;
+    if (!arena) lock = std::unique_lock<std::mutex>(shared_mtx);
+    else if (!arena->pools) return string_pool_t::stats_t();
+    return pools_of(arena).strings.stats();
+}
+
+const uint8_t* val_t::ordered(size_t& len) const {
+    const extra_t* x = extra();
+    if (x && !x->comps.empty()) {
+        len = x->comps.text.size();
+        return (const uint8_t*)x->comps.text.data();
+    }
+    if (numeric) {
+        len = sizeof(number);
+        return (const uint8_t*)&number;
+    }
+    const std::string* t = text();
+    len = t->size();
+    return (const uint8_t*)t->data();
+}
+
+uint64_t val_t::prefix() const {
+    const extra_t* x = extra();
+    if (!numeric || (x && !x->comps.empty())) return number;
+    // the bytes of the number, in memory order
+    uint64_t p;
+    memcpy(&p, &number, sizeof(p));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    p = __builtin_bswap64(p);
+#endif
+    return p;
+}
+
 std::string val_t::to_string() const {
     std::string s = "";
-    if (comps.size() > 0) {
-        for (const auto& c : comps) {
-            s += (s == "" ? "" : ", ") + c.first + "=" + c.second.to_string();
+    const comps_t& comps = get_comps();
+    if (!comps.empty()) {
+        for (size_t i = 0; i < comps.size(); ++i) {
+            size_t len;
+            const char* text = comps.component(i, len);
+            s += (s == "" ? "" : ", ") + comps.layout->names[i] + "=" + prioritized_t(std::string(text, len), comps.layout->rank[i]).to_string();
         }
         return "{ " + s + " }";
     }
+    const auto& alternatives = get_alternatives();
     if (alternatives.size() > 0) {
         s = get_value();
         for (const auto& a : alternatives) {
@@ -324,89 +529,84 @@ std::string val_t::to_string() const {
     return get_value();
 }
 
-void val_t::did_change() {
-    size_t bytes = comps.size() > 0 ? 0 : numeric ? sizeof(number) : _value.size();
-    for (const auto& c : comps) bytes += c.second.label.size();
-    if (complen == 0) {
-        comparable = (uint8_t*)malloc(bytes);
-    } else if (complen < bytes) {
-        comparable = (uint8_t*)realloc(comparable, bytes);
-    }
-    complen = bytes;
-    if (numeric) {
-        memcpy(comparable, &number, sizeof(number));
-        return;
-    }
-    if (comps.size() == 0) {
-        memcpy(comparable, _value.c_str(), _value.size());
-        return;
-    }
-    uint8_t* pos = comparable;
-    std::vector<std::string> order;
-    order.resize(comps.size());
-    for (const auto& i : comps) {
-        order[i.second.priority] = i.first;
-    }
-    for (const auto& c : order) {
-        const auto& a = comps.at(c).label;
-        memcpy(pos, a.c_str(), a.size());
-        pos += a.size();
-    }
-}
-
 const std::string& val_t::get_value() const {
-    if (numeric && number != cached_number) {
-        cached_number = number;
-        _value = std::to_string(number);
-    }
-    return _value;
+    if (!numeric) return *text();
+    // the text of numbers is not kept, as most are only ever written once
+    static thread_local std::string formatted;
+    formatted = std::to_string(number);
+    return formatted;
+}
+const comps_t& val_t::get_comps() const {
+    static const comps_t none = comps_t();
+    const extra_t* x = extra();
+    return x ? x->comps : none;
 }
-const std::map<std::string, prioritized_t>& val_t::get_comps() const { return comps; }
-void val_t::set_value(const std::string& new_value) { _value = new_value; did_change(); }
-void val_t::set_comps(const std::map<std::string, prioritized_t>& new_comps, const std::string& new_value) { comps = new_comps; _value = new_value; did_change(); }
+const std::vector<std::string>& val_t::get_alternatives() const {
+    static const std::vector<std::string> none;
+    const extra_t* x = extra();
+    return x ? x->alternatives : none;
+}
+// the value may live in an arena, but is not told which, so its new text goes in the shared pool
+void val_t::set_value(const std::string& new_value) { assign(new_value, get_comps(), get_alternatives(), nullptr); }
+void val_t::set_comps(const comps_t& new_comps, const std::string& new_value) { assign(new_value, new_comps, get_alternatives(), nullptr); }
 bool val_t::is_number() const { return numeric; }
-int64_t val_t::get_number() const { return number; }
+int64_t val_t::get_number() const { return numeric ? number : 0; }
 void val_t::set_number(int64_t v) {
+    if (!numeric) return;
     number = v;
-    did_change();
+    // the text is made anew, when asked for
+    if (!(_value & 1)) _value = 0;
 }
 
 bool val_t::operator<(const val_t& other) const {
-    int c = memcmp(comparable, other.comparable, complen > other.complen ? other.complen : complen);
-    return c ? c < 0 : other.complen > complen;
+    const uint64_t p = prefix(), other_p = other.prefix();
+    if (p != other_p) return p < other_p;
+    size_t complen, other_complen;
+    const uint8_t* a = ordered(complen);
+    const uint8_t* b = other.ordered(other_complen);
+    // the same pooled string is the same text
+    if (a == b && complen == other_complen) return false;
+    int c = memcmp(a, b, complen > other_complen ? other_complen : complen);
+    return c ? c < 0 : other_complen > complen;
 }
 
 bool val_t::fits(const val_t& value) const {
+    const auto& alternatives = get_alternatives();
     if (alternatives.size() == 0) {
-        if (value.alternatives.size() > 0) {
+        if (value.get_alternatives().size() > 0) {
             return value.fits(*this);
         }
         return !(*this < value) && !(value < *this);
     }
-    if (comps.size() > 0) {
+    if (!get_comps().empty()) {
         throw std::runtime_error("components and fitted vars are unsupported");
     }
     for (const auto& a : alternatives) {
-        if (value._value == a) return true;
+        if (value.get_value() == a) return true;
     }
     return false;
 }
 
-Value val_t::clone() const {
-    Value val = std::make_shared<val_t>(*this);
-    val->comparable = (uint8_t*)malloc(complen);
-    memcpy(val->comparable, comparable, complen);
-    return val;
+int64_t val_t::to_int64(const std::string& value) {
+    int64_t v;
+    return number::parse(value.data(), value.size(), v) ? v : (int64_t)atoll(value.c_str());
 }
 
-void val_t::aggregate(const val_t& v, uint8_t curr_phase) {
+Value val_t::clone(arena_t* arena) const {
+    if (!arena) return std::make_shared<val_t>(*this);
+    return Value(Value(), arena->make<val_t>(*this));
+}
+
+void val_t::aggregate(const val_t& v, uint32_t curr_phase) {
     if (!v.numeric) {
         v.number = v.int64();
         v.numeric = true;
+        if (!(v._value & 1)) v._value = 0;
     }
     if (curr_phase != phase) {
-        numeric = true;
         number = v.number;
+        if (!numeric && !(_value & 1)) _value = 0;
+        numeric = true;
         phase = curr_phase;
         return;
     }
@@ -415,4 +615,5 @@ void val_t::aggregate(const val_t& v, uint8_t curr_phase) {
         numeric = true;
     }
     number += v.number;
+    if (!(_value & 1)) _value = 0;
 }
@@ -1,58 +1,142 @@
+#ifndef included_env_h_
+#define included_env_h_
+
 #include <map>
+#include <set>
 #include <memory>
 
 #include "parser/parser.h"
+#include "intern.h"
+#include "arena.h"
 
 using parser::prioritized_t;
 using parser::ref;
 
+/**
+ * The components an `as` declaration scans its input into (e.g. year, month and day), in the order
+ * they are scanned, along with the order they are compared in. Declarations of the same components
+ * share one layout, which is never freed.
+ */
+struct layout_t {
+    static const size_t MAX_COMPONENTS = 8;
+    std::vector<std::string> names;
+    std::vector<uint8_t> rank; // the position of each component in the order they are compared in
+    // the layout of varnames (names with priorities), made once for each distinct list
+    static const layout_t* of(const std::vector<prioritized_t>& varnames);
+};
+
+/**
+ * The components of a scanned value, packed in a fixed layout: their text back to back, in the
+ * order they are compared in, and the end of each of them in that text. The text of short values
+ * such as dates is kept inline, so packing them allocates nothing.
+ */
+struct comps_t {
+    const layout_t* layout{nullptr};
+    std::string text;
+    uint16_t ends[layout_t::MAX_COMPONENTS];
+    bool empty() const { return layout == nullptr; }
+    size_t size() const { return layout ? layout->names.size() : 0; }
+    // the text of the component scanned at position i, which is len bytes long
+    const char* component(size_t i, size_t& len) const {
+        const uint8_t r = layout->rank[i];
+        const size_t begin = r ? ends[r - 1] : 0;
+        len = ends[r] - begin;
+        return text.data() + begin;
+    }
+    // pack the components of layout_in, given their text back to back and the length of each, in
+    // the order they are scanned
+    void pack(const layout_t* layout_in, const char* scanned, const size_t* lengths);
+};
+
 struct mutable_val_t {
     std::string value;
-    std::map<std::string, prioritized_t> comps;
+    comps_t comps;
     std::vector<std::string> alternatives;
     bool numeric{false};
+    int64_t number{0}; // the value of value, if numeric
 };
 
+/**
+ * A value, in 24 bytes: the (pooled) text, the number or the prefix the value is ordered by, and
+ * flags. The rare parts of values (components, and the alternatives of fit values) are pooled as
+ * well, along with the text, so that values with the same ones share them. Values made in an
+ * arena use the pools of the arena, and so point into it; the few made outside of arenas share a
+ * pool that lives as long as the process.
+ */
 class val_t {
+    friend class snapshot_writer_t;
+    friend class snapshot_reader_t;
+public:
+    struct extra_t {
+        const std::string* text;
+        comps_t comps;
+        std::vector<std::string> alternatives;
+    };
 private:
-    mutable std::string _value;
-    std::map<std::string, prioritized_t> comps;
-    uint8_t* comparable;
-    size_t complen;
-    mutable int64_t number;
-    mutable int64_t cached_number{-1};
-    mutable bool numeric;
-    void did_change();
+    // the pooled text, or if the low bit is set, the pooled extra_t; null for numbers, whose text
+    // is made from the number when asked for
+    mutable uintptr_t _value;
+    // for numeric values, the number; for others, the first 8 bytes they are ordered by, as a
+    // big-endian integer (zero padded), which settles most comparisons without looking further
+    mutable int64_t number{0};
+    mutable bool numeric{false};
+    const extra_t* extra() const { return _value & 1 ? (const extra_t*)(_value - 1) : nullptr; }
+    const std::string* text() const { return _value & 1 ? extra()->text : (const std::string*)_value; }
+    // the bytes values are ordered by: those of the components, or of the number, or of the text
+    const uint8_t* ordered(size_t& len) const;
+    uint64_t prefix() const;
+    // set the text, components and alternatives, pooled in arena if there is one, and the prefix of
+    // non-numeric values
+    void assign(const std::string& value, const comps_t& comps, const std::vector<std::string>& alternatives, arena_t* arena);
     // this differs from get_number() in that it forcibly converts value, whereas get_number() assumes numeric=true
-    int64_t int64() const { int64_t x = cached_number; cached_number = number; auto rv = (int64_t)atoll(get_value().c_str()); cached_number = x; return rv; }
+    int64_t int64() const { return numeric ? number : to_int64(*text()); }
 public:
-    std::vector<std::string> alternatives;
-    uint8_t phase{0};
-    val_t(const mutable_val_t& mv) : _value(mv.value), comps(mv.comps), comparable(nullptr), complen(0), numeric(mv.numeric), alternatives(mv.alternatives) {
-        if (numeric) number = int64(); did_change();
-    }
-    val_t(const std::string& value_in = "") : _value(value_in), comparable(nullptr), complen(0) { did_change(); }
-    std::shared_ptr<val_t> clone() const;
+    uint32_t phase{0};
+    // the value, with its text pooled in arena if there is one (see make_value())
+    val_t(const mutable_val_t& mv, arena_t* arena = nullptr) : number(mv.number), numeric(mv.numeric) { assign(mv.value, mv.comps, mv.alternatives, arena); }
+    val_t(const std::string& value_in = "", arena_t* arena = nullptr) { assign(value_in, comps_t(), std::vector<std::string>(), arena); }
+    // a copy of the value, made in arena if there is one; it shares the pooled text of the value
+    std::shared_ptr<val_t> clone(arena_t* arena = nullptr) const;
+    // the text of the value; that of a number is made anew on each call, and only lasts until the
+    // next call on the same thread
     const std::string& get_value() const;
-    const std::map<std::string, prioritized_t>& get_comps() const;
+    const comps_t& get_comps() const;
+    const std::vector<std::string>& get_alternatives() const;
     void set_value(const std::string& new_value);
-    void set_comps(const std::map<std::string, prioritized_t>& comps, const std::string& new_value = "");
+    void set_comps(const comps_t& comps, const std::string& new_value = "");
     bool operator<(const val_t& other) const;
     std::string to_string() const;
-    void aggregate(const val_t& v, uint8_t curr_phase);
+    void aggregate(const val_t& v, uint32_t curr_phase);
     bool is_number() const;
     int64_t get_number() const;
     void set_number(int64_t v);
     bool fits(const val_t& value) const;
+    // the integer part of value if it is numeric, or else whatever atoll() makes of it
+    static int64_t to_int64(const std::string& value);
+    // values with the same identity are equal: it is made of the pooled text or extra_t, and the
+    // number or prefix
+    typedef std::pair<uintptr_t, int64_t> identity_t;
+    identity_t identity() const { return identity_t(_value, number); }
+    // the text interned by the values made in arena, or by those made outside of arenas if null
+    static string_pool_t::stats_t interned(arena_t* arena);
 };
 
 typedef std::shared_ptr<val_t> Value;
 
+/**
+ * A value made from args, in arena if there is one. Values made in an arena are not counted: the
+ * pointer owns nothing, and the value and its pooled text live exactly as long as the arena does.
+ */
+template<typename... Args> inline Value make_value(arena_t* arena, Args&&... args) {
+    if (!arena) return std::make_shared<val_t>(std::forward<Args>(args)...);
+    return Value(Value(), arena->make<val_t>(std::forward<Args>(args)..., arena));
+}
+
 struct var_t {
     std::string str; // this is the string associated with this variable, e.g. "date" or "Province/Region".
     std::string value; // this is the actual value at the moment (e.g. "2021-01-05")
     std::vector<std::shared_ptr<var_t>> fit; // this is a fit vector for combining multiple fields
-    std::map<std::string, std::string> comps;
+    comps_t comps; // as scanned, in layout
     int index{-1};
     bool trails{false};
     bool key{false};
@@ -60,19 +144,42 @@ struct var_t {
     bool aggregates{false};
     bool helper{false};
     std::map<std::string,std::string> exceptions; // "Burma" == "Myanmar"
+    // set by read_number(): the value is number, and its text is only made if asked for
+    bool numbered{false};
+    int64_t number{0};
 
     ref pref{0};
     std::string fmt;
     std::vector<prioritized_t> varnames;
+    const layout_t* layout{nullptr}; // of varnames
+    // for each component, its position in the layout values were last read in, if not layout
+    const layout_t* read_layout{nullptr};
+    std::vector<uint8_t> read_positions;
     var_t(const std::string& str_in = "") : str(str_in) {}
     var_t(const std::string& str_in, bool numeric_in) : str(str_in), numeric(numeric_in) {}
     var_t(const std::string& str_in, bool numeric_in, const std::map<std::string,std::string>& exceptions_in) : str(str_in), numeric(numeric_in), exceptions(exceptions_in) {}
     void read(const std::string& input);
+    void read(const char* input, size_t len);
+    // read a number that is known up front (e.g. from a table), for passthrough() vars only; it must
+    // not be negative, as such cells are text rather than numeric values
+    void read_number(int64_t input) { numbered = true; number = input; }
     std::string write() const;
     std::string to_string() const;
     bool operator<(const var_t& other) const;
-    Value imprint(std::set<std::string>& fitness_set) const;
+    // the value of the var, made in arena if there is one
+    Value imprint(std::set<std::string>& fitness_set, arena_t* arena = nullptr) const;
+    /**
+     * The value imprint() gives, except that the version of a fit is not picked yet: value holds
+     * the first version, and alternatives the others. This does not touch the fitness set, so it
+     * can be done ahead of time, on any thread; resolve() then picks the version, in order.
+     */
+    mutable_val_t stage() const;
+    static void resolve(mutable_val_t& val, std::set<std::string>& fitness_set);
     void read(const val_t& val);
+    // whether written values are guaranteed to never contain a comma (i.e. never need quoting)
+    bool plain() const;
+    // whether write() after read(val) simply gives back val's value
+    bool passthrough() const { return fmt.size() == 0 && fit.size() == 0 && exceptions.size() == 0; }
 };
 
 typedef std::shared_ptr<var_t> Var;
@@ -135,3 +242,5 @@ struct env_t: public parser::st_callback_table {
     ref key(ref source) override;
     ref helper(ref source) override;
 };
+
+#endif // included_env_h_
@@ -0,0 +1,50 @@
+#include <cstring>
+
+#include "intern.h"
+#include "cache.h"
+
+string_pool_t::stats_t& string_pool_t::stats_t::operator+=(const stats_t& other) {
+    requests += other.requests;
+    distinct += other.distinct;
+    bytes += other.bytes;
+    saved += other.saved;
+    return *this;
+}
+
+void string_pool_t::grow() {
+    std::vector<slot_t> old;
+    old.swap(table);
+    // most pools are those of small documents, such as the files of a directory
+    table.resize(old.size() ? old.size() * 2 : 64);
+    const size_t mask = table.size() - 1;
+    for (const auto& e : old) {
+        if (!e.string) continue;
+        size_t i = e.hash & mask;
+        while (table[i].string) i = (i + 1) & mask;
+        table[i] = e;
+    }
+}
+
+const std::string* string_pool_t::intern(const char* s, size_t len) {
+    hasher_t h;
+    h.add(s, len);
+    const uint64_t hash = h.h;
+    ++counts.requests;
+    // kept at most half full
+    if (counts.distinct * 2 >= table.size()) grow();
+    const size_t mask = table.size() - 1;
+    size_t i = hash & mask;
+    for (; table[i].string; i = (i + 1) & mask) {
+        const slot_t& e = table[i];
+        if (e.hash == hash && e.string->size() == len && !memcmp(e.string->data(), s, len)) {
+            counts.saved += len;
+            return e.string;
+        }
+    }
+    strings.emplace_back(s, len);
+    table[i].hash = hash;
+    table[i].string = &strings.back();
+    ++counts.distinct;
+    counts.bytes += len;
+    return table[i].string;
+}
@@ -0,0 +1,40 @@
+#ifndef included_intern_h_
+#define included_intern_h_
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+ * Pool of distinct strings. The same place names, regions and dates turn up in millions of cells,
+ * so values hold a pointer to the pooled copy of their text rather than a copy of their own; two
+ * strings of a pool are equal if and only if they are the same pointer. Every arena has a pool of
+ * its own for the values made in it (see val_t), which is freed along with it. Like the arena, a
+ * pool is not thread safe.
+ */
+class string_pool_t {
+public:
+    struct stats_t {
+        size_t requests{0};     // strings interned
+        size_t distinct{0};     // strings in the pool
+        size_t bytes{0};        // bytes of text in the pool
+        size_t saved{0};        // bytes of text the requests would have taken beyond that
+        stats_t& operator+=(const stats_t& other);
+    };
+    // the pooled copy of the len bytes at s
+    const std::string* intern(const char* s, size_t len);
+    const std::string* intern(const std::string& s) { return intern(s.data(), s.size()); }
+    const stats_t& stats() const { return counts; }
+private:
+    struct slot_t {
+        uint64_t hash{0};
+        const std::string* string{nullptr};
+    };
+    std::deque<std::string> strings; // never moved once added
+    std::vector<slot_t> table;       // open addressing over strings; a power of 2 in size
+    stats_t counts;
+    void grow();
+};
+
+#endif // included_intern_h_
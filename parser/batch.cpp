@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+// the open/statx/read/close operations arrived together with this feature flag (Linux 5.6)
+#if defined(IORING_FEAT_RW_CUR_POS) && defined(STATX_SIZE) && defined(__NR_io_uring_setup)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#include "batch.h"
+
+// largest single read submitted; io_uring read lengths are 32 bit
+static const size_t MAX_READ = 1 << 30;
+
+#ifdef HAVE_IO_URING
+
+/**
+ * Minimal io_uring wrapper using the raw system calls, so that liburing is not needed. Only a
+ * single thread (the loader) ever touches the ring.
+ */
+struct uring_t {
+    int fd{-1};
+    void* sq_ring{MAP_FAILED};
+    size_t sq_ring_len{0};
+    void* cq_ring{MAP_FAILED};
+    size_t cq_ring_len{0};
+    io_uring_sqe* sqes{(io_uring_sqe*)MAP_FAILED};
+    size_t sqes_len{0};
+    unsigned *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    io_uring_cqe* cqes;
+    unsigned queued{0}; // entries added since the last submission
+    unsigned pending{0}; // entries added whose completions have not been handled yet
+
+    ~uring_t() {
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_len);
+        if (cq_ring != MAP_FAILED && cq_ring != sq_ring) munmap(cq_ring, cq_ring_len);
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_len);
+        if (fd >= 0) close(fd);
+    }
+
+    // set up a ring, returning nullptr if the kernel does not support the operations needed
+    static std::unique_ptr<uring_t> create(unsigned entries);
+
+    // add an entry to the submission queue; at most entries may be queued between completions
+    void queue(const io_uring_sqe& entry) {
+        unsigned tail = *sq_tail;
+        unsigned index = tail & *sq_mask;
+        sqes[index] = entry;
+        sq_array[index] = index;
+        __atomic_store_n(sq_tail, tail + 1, __ATOMIC_RELEASE);
+        ++queued;
+        ++pending;
+    }
+
+    // submit everything queued, and call handle(cqe) for the next count completions
+    template<typename Handler>
+    void complete(unsigned count, Handler handle) {
+        while (count > 0) {
+            int rv = syscall(__NR_io_uring_enter, fd, queued, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (rv < 0) {
+                // EAGAIN (out of memory for now) and EBUSY (the completion queue is full, until
+                // it is reaped below) pass, so try again
+                if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+                    throw std::runtime_error(std::string("io_uring_enter failed: ") + strerror(errno));
+                }
+                rv = 0;
+            }
+            queued -= rv;
+            unsigned head = *cq_head;
+            unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+            for (; head != tail && count > 0; ++head, --count, --pending) handle(cqes[head & *cq_mask]);
+            __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+        }
+    }
+
+    // wait for every pending entry, discarding the completions; returns false if the ring fails
+    // first, in which case they may still complete (and write to their buffers) at any time
+    bool drain() {
+        try {
+            complete(pending, [](const io_uring_cqe&) {});
+            return true;
+        } catch (const std::exception&) {
+            return false;
+        }
+    }
+};
+
+std::unique_ptr<uring_t> uring_t::create(unsigned entries) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    std::unique_ptr<uring_t> ring(new uring_t());
+    ring->fd = syscall(__NR_io_uring_setup, entries, &params);
+    if (ring->fd < 0) return nullptr; // ENOSYS on old kernels, EPERM where it is disabled
+
+    // make sure the operations needed are all supported
+    const unsigned char needed[] = { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ, IORING_OP_CLOSE };
+    std::vector<char> probe_buf(sizeof(io_uring_probe) + 256 * sizeof(io_uring_probe_op));
+    io_uring_probe* probe = (io_uring_probe*)probe_buf.data();
+    if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) < 0) return nullptr;
+    for (unsigned char op : needed) {
+        if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED)) return nullptr;
+    }
+
+    ring->sq_ring_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    ring->cq_ring_len = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->sq_ring_len = ring->cq_ring_len = std::max(ring->sq_ring_len, ring->cq_ring_len);
+    }
+    ring->sq_ring = mmap(nullptr, ring->sq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ring == MAP_FAILED) return nullptr;
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        ring->cq_ring = ring->sq_ring;
+    } else {
+        ring->cq_ring = mmap(nullptr, ring->cq_ring_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ring == MAP_FAILED) return nullptr;
+    }
+    ring->sqes_len = params.sq_entries * sizeof(io_uring_sqe);
+    ring->sqes = (io_uring_sqe*)mmap(nullptr, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) return nullptr;
+
+    char* sq = (char*)ring->sq_ring;
+    char* cq = (char*)ring->cq_ring;
+    ring->sq_tail = (unsigned*)(sq + params.sq_off.tail);
+    ring->sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned*)(sq + params.sq_off.array);
+    ring->cq_head = (unsigned*)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned*)(cq + params.cq_off.tail);
+    ring->cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+    ring->cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+    return ring;
+}
+
+#else // HAVE_IO_URING
+
+struct uring_t {
+    static std::unique_ptr<uring_t> create(unsigned /* entries */) { return nullptr; }
+};
+
+#endif // HAVE_IO_URING
+
+file_batch_t::file_batch_t(std::vector<std::string> paths_in, size_t window_in)
+: paths(std::move(paths_in))
+, window(window_in)
+{
+    // each file of a window needs two entries in flight at once (open and statx)
+    ring = uring_t::create(2 * window);
+    loader = std::thread(&file_batch_t::run, this);
+}
+
+file_batch_t::~file_batch_t() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        cancelled = true;
+        taken_cv.notify_one();
+    }
+    loader.join();
+}
+
+bool file_batch_t::next(loaded_file_t& file) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (handed_out == paths.size()) return false;
+    ready_cv.wait(lock, [this] { return !ready.empty(); });
+    file = std::move(ready.front());
+    ready.pop_front();
+    ++handed_out;
+    taken_cv.notify_one();
+    return true;
+}
+
+void file_batch_t::run() {
+    for (size_t begin = 0; begin < paths.size(); begin += window) {
+        {
+            // stay at most one window ahead of the consumer
+            std::unique_lock<std::mutex> lock(mtx);
+            taken_cv.wait(lock, [this] { return cancelled || ready.size() < window; });
+            if (cancelled) return;
+        }
+        size_t end = std::min(begin + window, paths.size());
+        std::vector<loaded_file_t> files(end - begin);
+        for (size_t i = begin; i < end; ++i) files[i - begin].path = paths[i];
+        if (!ring || !load_uring(begin, end, files)) {
+            // no ring, or it failed part way (and is gone for good): load the window the slow way
+            files = std::vector<loaded_file_t>(end - begin);
+            for (size_t i = begin; i < end; ++i) files[i - begin].path = paths[i];
+            load_threads(begin, end, files);
+        }
+        std::lock_guard<std::mutex> lock(mtx);
+        for (auto& f : files) ready.push_back(std::move(f));
+        ready_cv.notify_one();
+    }
+}
+
+#ifdef HAVE_IO_URING
+
+/**
+ * What the entries of a window in flight write to, besides the files: the fds opened, the sizes
+ * stat'ed and the lengths read so far.
+ */
+struct uring_window_t {
+    std::vector<int> fds;
+    std::vector<struct statx> stats;
+    std::vector<size_t> got;
+    uring_window_t(size_t n) : fds(n, -1), stats(n), got(n, 0) {}
+    void close_fds() { for (int& fd : fds) if (fd >= 0) { close(fd); fd = -1; } }
+};
+
+static void load_window(uring_t& ring, std::vector<loaded_file_t>& files, uring_window_t& w) {
+    const size_t n = files.size();
+    std::vector<int>& fds = w.fds;
+    std::vector<struct statx>& stats = w.stats;
+    std::vector<size_t>& got = w.got;
+    io_uring_sqe sqe;
+
+    // open and stat every file in the window
+    for (size_t i = 0; i < n; ++i) {
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_OPENAT;
+        sqe.fd = AT_FDCWD;
+        sqe.addr = (uint64_t)files[i].path.c_str();
+        sqe.open_flags = O_RDONLY | O_CLOEXEC;
+        sqe.user_data = i;
+        ring.queue(sqe);
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_STATX;
+        sqe.fd = AT_FDCWD;
+        sqe.addr = (uint64_t)files[i].path.c_str();
+        sqe.len = STATX_SIZE;
+        sqe.off = (uint64_t)&stats[i];
+        sqe.user_data = n + i;
+        ring.queue(sqe);
+    }
+    ring.complete(2 * n, [&](const io_uring_cqe& cqe) {
+        size_t i = cqe.user_data % n;
+        if (cqe.res < 0) {
+            if (files[i].error.empty()) files[i].error = strerror(-cqe.res);
+        } else if (cqe.user_data < n) {
+            fds[i] = cqe.res;
+        }
+    });
+
+    // read them, resubmitting the remainder of any short reads
+    std::vector<size_t> reading;
+    for (size_t i = 0; i < n; ++i) {
+        if (fds[i] < 0 || files[i].error.size() > 0) continue;
+        files[i].data.resize(stats[i].stx_size);
+        if (stats[i].stx_size > 0) reading.push_back(i);
+    }
+    while (!reading.empty()) {
+        for (size_t i : reading) {
+            memset(&sqe, 0, sizeof(sqe));
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = fds[i];
+            sqe.addr = (uint64_t)(files[i].data.data() + got[i]);
+            sqe.len = std::min(files[i].data.size() - got[i], MAX_READ);
+            sqe.off = got[i];
+            sqe.user_data = i;
+            ring.queue(sqe);
+        }
+        std::vector<size_t> again;
+        ring.complete(reading.size(), [&](const io_uring_cqe& cqe) {
+            size_t i = cqe.user_data;
+            if (cqe.res < 0 && cqe.res != -EINTR && cqe.res != -EAGAIN) {
+                files[i].error = strerror(-cqe.res);
+                files[i].data.clear();
+                return;
+            }
+            if (cqe.res == 0) {
+                // the file shrank since it was stat'ed
+                files[i].data.resize(got[i]);
+                return;
+            }
+            if (cqe.res > 0) got[i] += cqe.res;
+            if (got[i] < files[i].data.size()) again.push_back(i);
+        });
+        reading.swap(again);
+    }
+
+    // and close them
+    size_t closing = 0;
+    for (size_t i = 0; i < n; ++i) {
+        if (fds[i] < 0) continue;
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = IORING_OP_CLOSE;
+        sqe.fd = fds[i];
+        fds[i] = -1;
+        ring.queue(sqe);
+        ++closing;
+    }
+    ring.complete(closing, [](const io_uring_cqe&) {});
+}
+
+bool file_batch_t::load_uring(size_t begin, size_t end, std::vector<loaded_file_t>& files) {
+    std::unique_ptr<uring_window_t> w(new uring_window_t(end - begin));
+    try {
+        load_window(*ring, files, *w);
+        return true;
+    } catch (const std::exception&) {
+        if (ring->drain()) {
+            // nothing is in flight any more, so the window can be given up on as usual
+            w->close_fds();
+            ring.reset();
+        } else {
+            // entries still in flight may yet write to the window's files, stats and fds (or be
+            // matched to later windows), so those and the ring are left be, for good
+            w.release();
+            new std::vector<loaded_file_t>(std::move(files));
+            ring.release();
+        }
+        return false;
+    }
+}
+
+#else // HAVE_IO_URING
+
+bool file_batch_t::load_uring(size_t, size_t, std::vector<loaded_file_t>&) {
+    return false;
+}
+
+#endif // HAVE_IO_URING
+
+static void load_file(loaded_file_t& file) {
+    int fd = open(file.path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        file.error = strerror(errno);
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st)) {
+        file.error = strerror(errno);
+        close(fd);
+        return;
+    }
+    file.data.resize(st.st_size);
+    size_t got = 0;
+    while (got < file.data.size()) {
+        ssize_t n = read(fd, file.data.data() + got, std::min(file.data.size() - got, MAX_READ));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            file.error = strerror(errno);
+            file.data.clear();
+            break;
+        }
+        if (n == 0) {
+            file.data.resize(got);
+            break;
+        }
+        got += n;
+    }
+    close(fd);
+}
+
+void file_batch_t::load_threads(size_t begin, size_t end, std::vector<loaded_file_t>& files) {
+    const size_t n = end - begin;
+    size_t threads = std::min<size_t>(std::max(std::thread::hardware_concurrency(), 1u), n);
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < threads; ++t) {
+        pool.emplace_back([&files, n, threads, t] {
+            for (size_t i = t; i < n; i += threads) load_file(files[i]);
+        });
+    }
+    for (auto& th : pool) th.join();
+}
@@ -0,0 +1,57 @@
+#ifndef included_batch_h_
+#define included_batch_h_
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * A file loaded in its entirety by a file_batch_t. If the file could not be opened or read, error
+ * holds the reason and data is empty.
+ */
+struct loaded_file_t {
+    std::string path;
+    std::vector<char> data;
+    std::string error;
+};
+
+struct uring_t;
+
+/**
+ * Loads a list of (typically many small) files into memory on a background thread, handing them
+ * out in list order. Files are loaded a window at a time: where the kernel supports it, the opens,
+ * reads and closes of a whole window are each submitted as a single io_uring batch; otherwise,
+ * the files of a window are loaded by a pool of threads. At most one window of loaded files is
+ * kept waiting for the consumer, so memory use is bounded by the size of the largest windows.
+ */
+class file_batch_t {
+public:
+    file_batch_t(std::vector<std::string> paths_in, size_t window_in = 64);
+    ~file_batch_t();
+    // get the next file, in list order; returns false once every file has been handed out
+    bool next(loaded_file_t& file);
+    // "io_uring" or "threads"
+    const char* backend() const { return ring ? "io_uring" : "threads"; }
+private:
+    std::vector<std::string> paths;
+    size_t window;
+    std::unique_ptr<uring_t> ring; // null if io_uring is unavailable
+    std::deque<loaded_file_t> ready;
+    size_t handed_out{0};
+    bool cancelled{false};
+    std::mutex mtx;
+    std::condition_variable ready_cv, taken_cv;
+    std::thread loader;
+
+    void run();
+    // load paths[begin, end) into files, which has room for end - begin entries; load_uring
+    // returns false if the ring failed, which is then given up for good and files left unusable
+    bool load_uring(size_t begin, size_t end, std::vector<loaded_file_t>& files);
+    void load_threads(size_t begin, size_t end, std::vector<loaded_file_t>& files);
+};
+
+#endif // included_batch_h_
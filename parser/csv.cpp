@@ -1,81 +1,379 @@
+#include <stdexcept>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 #include "csv.h"
+#include "table.h"
+
+// pages behind the read position are released in batches of this size
+static const size_t MMAP_DROP_WINDOW = 64 << 20;
+// structural characters are located this many bytes at a time (must be a multiple of 64)
+static const size_t SCAN_CHUNK = 256 << 10;
+
+csv_writer::csv_writer(std::unique_ptr<output_t> out_in, size_t capacity) : out(std::move(out_in)), cap(capacity) {
+    buf = (char*)malloc(cap);
+}
+
+csv_writer::~csv_writer() {
+    free(buf);
+}
+
+void csv_writer::flush() {
+    out->write(buf, len);
+    len = 0;
+}
+
+void csv_writer::close() {
+    flush();
+    out->close();
+}
 
-std::string csv::stringify(const std::vector<std::string>& vec) {
-    std::string s = "";
-    for (const auto& t : vec) {
-        s += (s == "" ? "" : ",") + t;
+void csv_writer::reserve(size_t bytes) {
+    if (len + bytes <= cap) return;
+    flush();
+    if (bytes > cap) {
+        cap = bytes;
+        buf = (char*)realloc(buf, cap);
     }
-    return s;
-}
-
-// void csv::parse(const char* buf, std::vector<std::string>& vec) {
-//     bool quoted = false;
-//     vec.resize(0);
-//     // printf("parsing %s\n", buf);
-//     size_t start = 0;
-//     for (size_t i = 0; buf[i - (i > 0)]; ++i) {
-//         if (quoted) {
-//             if (buf[i] == '"') {
-//                 quoted = false;
-//             }
-//         } else if (!buf[i] || buf[i] == ',' || buf[i] == '\n') {
-//             vec.emplace_back(&buf[start], &buf[i]);
-//             start = i + 1;
-//             // printf("emplaced %s\n", vec.back().c_str());
-//             if (buf[i] == '\n') return;
-//         }
-//     }
-
-//     return;
-// }
-
-void csv::write(const std::vector<std::string>& vec) {
-    for (size_t i = 0; i < vec.size(); ++i) {
-        const std::string& string = vec.at(i);
-        const char* cs = string.c_str();
-
-        if (i > 0) fputc(',', fp);
-
-        bool quote = (string.find(',') != std::string::npos);
-
-        if (quote) fputc('"', fp);
-        while (*cs) {
-            fputc(*cs, fp);
-            cs++;
-        }
-        if (quote) fputc('"', fp);
+}
+
+void csv_writer::set_plain(size_t column_in, bool plain_in) {
+    if (plain.size() <= column_in) plain.resize(column_in + 1, false);
+    plain[column_in] = plain_in;
+}
+
+void csv_writer::field(const char* s, size_t slen) {
+    bool quote = (column >= plain.size() || !plain[column]) && memchr(s, ',', slen);
+    reserve(slen + 3);
+    if (column++ > 0) buf[len++] = ',';
+    if (quote) buf[len++] = '"';
+    memcpy(buf + len, s, slen);
+    len += slen;
+    if (quote) buf[len++] = '"';
+}
+
+void csv_writer::field(int64_t v) {
+    char digits[20];
+    char* p = digits + sizeof(digits);
+    uint64_t u = v < 0 ? 0 - uint64_t(v) : uint64_t(v);
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u);
+    size_t n = digits + sizeof(digits) - p;
+    reserve(n + 2);
+    if (column++ > 0) buf[len++] = ',';
+    if (v < 0) buf[len++] = '-';
+    memcpy(buf + len, p, n);
+    len += n;
+}
+
+void csv_writer::end_row() {
+    reserve(1);
+    buf[len++] = '\n';
+    column = 0;
+}
+
+void row_writer::write(const std::vector<std::string>& row) {
+    for (const auto& s : row) field(s);
+    end_row();
+}
+
+std::unique_ptr<row_writer> row_writer::open(FILE* fp, const std::string& path, bool threaded) {
+    if (path.size() > 4 && path.compare(path.size() - 4, 4, ".cmb") == 0) {
+        return std::unique_ptr<row_writer>(new table_writer(std::unique_ptr<output_t>(new output_t(fp))));
     }
-    fputc('\n', fp);
+    return std::unique_ptr<row_writer>(new csv_writer(output_t::open(fp, path, threaded)));
 }
 
-bool csv::read(std::vector<std::string>& vec) {
+const char* csv_parse_row(const char* pos, const char* end, csv_row_t& row) {
+    row.clear();
+    const char* start = pos;
     bool quoted = false;
-    vec.resize(0);
-    // printf("parsing %s\n", buf);
-    char ch, buf[512];
-    size_t len = 0;
-    short crop = 0;
-    while (EOF != (ch = buf[len++] = fgetc(fp))) {
+    size_t crop = 0;
+    for (; pos < end; ++pos) {
+        const char ch = *pos;
         if (quoted) {
             if (ch == '"') {
                 quoted = false;
                 crop = 1;
             }
         } else if (ch == ',' || ch == '\n') {
-            buf[len - crop - 1] = 0;
-            vec.emplace_back(&buf[crop]);
-            len = 0;
+            row.emplace_back(start + crop, pos - start - 2 * crop);
+            start = pos + 1;
             crop = 0;
-            // printf("emplaced %s\n", vec.back().c_str());
-            if (ch == '\n' || ch == -1) return true;
+            if (ch == '\n') return pos + 1;
         } else if (ch == '"') {
             quoted = true;
         }
     }
-    if (!ch && len > 1) {
-        buf[len - crop - 1] = 0;
-        vec.emplace_back(&buf[crop]);
+    // unterminated last row
+    if (pos > start || row.size() > 0) row.emplace_back(start + crop, pos - start - 2 * crop);
+    return end;
+}
+
+std::unique_ptr<csv_reader> csv_reader::open(FILE* fp, size_t threads, io_mode io) {
+    unsigned char magic[input_t::MAGIC_LEN];
+    size_t magic_len = fread(magic, 1, sizeof(magic), fp);
+    struct stat st;
+    if (!input_t::compressed(magic, magic_len) && 0 == fstat(fileno(fp), &st) && S_ISREG(st.st_mode) && st.st_size > 0) {
+        if (io != io_mode::mmap) {
+            std::unique_ptr<input_t> input(new readahead_input(fp, io == io_mode::direct));
+            return std::unique_ptr<csv_reader>(new stream_csv(std::move(input), readahead_input::SLOTS, readahead_input::CHUNK_SIZE));
+        }
+        if (threads > 1 && size_t(st.st_size) > 2 * parallel_csv::CHUNK_SIZE) {
+            return std::unique_ptr<csv_reader>(new parallel_csv(fp, st.st_size, threads));
+        }
+        return std::unique_ptr<csv_reader>(new mmap_csv(fp, st.st_size));
     }
+    return std::unique_ptr<csv_reader>(new stream_csv(input_t::open(fp, magic, magic_len)));
+}
+
+mapped_file_t::mapped_file_t(FILE* fp_in, size_t size_in) : fp(fp_in), size(size_in) {
+    base = (char*)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+    if (base == MAP_FAILED) {
+        fclose(fp);
+        throw std::runtime_error("failed to map CSV file into memory");
+    }
+    madvise(base, size, MADV_SEQUENTIAL);
+}
+
+mapped_file_t::~mapped_file_t() {
+    munmap(base, size);
+    fclose(fp);
+}
+
+void mapped_file_t::release(size_t pos) {
+    size_t consumed = pos & ~(size_t(sysconf(_SC_PAGESIZE)) - 1);
+    if (consumed - dropped >= MMAP_DROP_WINDOW) {
+        madvise(base + dropped, consumed - dropped, MADV_DONTNEED);
+        dropped = consumed;
+    }
+}
+
+// append the field ending at the separator in entry, and return the start of the next field
+static inline size_t push_field(const char* base, size_t pos, uint64_t entry, csv_row_t& fields) {
+    const size_t at = csv_scan::entry_offset(entry);
+    const size_t crop = (entry & csv_scan::crop_flag) ? 1 : 0;
+    fields.emplace_back(base + pos + crop, at - pos - 2 * crop);
+    return at + 1;
+}
+
+// the field running from pos to the end of an unterminated file
+static inline csv_field_t tail_field(const char* base, size_t pos, size_t size) {
+    csv_row_t tail;
+    csv_parse_row(base + pos, base + size, tail);
+    return tail.size() > 0 ? tail.back() : csv_field_t(base + size, 0);
+}
+
+// like push_field, for the field in the given column of a row, but leaving out unneeded columns
+static inline size_t project_field(const char* base, size_t pos, uint64_t entry, size_t column, const std::vector<bool>& needed, csv_row_t& fields) {
+    if (needed.empty() || (column < needed.size() && needed[column])) return push_field(base, pos, entry, fields);
+    if (column < needed.size()) fields.emplace_back();
+    return csv_scan::entry_offset(entry) + 1;
+}
 
-    return vec.size() > 0;
+// like tail_field, but leaving out unneeded columns
+static inline void project_tail(const char* base, size_t pos, size_t size, size_t column, const std::vector<bool>& needed, csv_row_t& fields) {
+    if (needed.empty() || (column < needed.size() && needed[column])) {
+        fields.push_back(tail_field(base, pos, size));
+    } else if (column < needed.size()) {
+        fields.emplace_back();
+    }
+}
+
+void csv_reader::project(std::vector<bool> needed_in) {
+    // drop the unneeded columns at the end, so that rows end right after the last needed one
+    while (!needed_in.empty() && !needed_in.back()) needed_in.pop_back();
+    // a projection of nothing at all would be indistinguishable from none; keep the first column
+    if (needed_in.empty()) needed_in.push_back(true);
+    needed = std::move(needed_in);
+}
+
+bool buffer_csv::read(csv_row_t& row) {
+    row.clear();
+    if (pos >= size) return false;
+    consumed(pos);
+    size_t column = 0;
+    for (;;) {
+        if (cursor == index.size()) {
+            if (scanned == size) {
+                project_tail(base, pos, size, column, needed, row);
+                pos = size;
+                return true;
+            }
+            size_t len = size - scanned < SCAN_CHUNK ? size - scanned : SCAN_CHUNK;
+            index.clear();
+            cursor = 0;
+            scanner.scan(base + scanned, len, scanned, index);
+            scanned += len;
+            continue;
+        }
+        const uint64_t entry = index[cursor++];
+        pos = project_field(base, pos, entry, column++, needed, row);
+        if (entry & csv_scan::newline_flag) return true;
+    }
+}
+
+void buffer_csv::seek(size_t offset) {
+    pos = scanned = offset < size ? offset : size;
+    scanner = csv_scan::scanner_t();
+    index.clear();
+    cursor = 0;
+}
+
+parallel_csv::parallel_csv(FILE* fp_in, size_t size_in, size_t threads_in)
+: file(fp_in, size_in)
+, threads(threads_in)
+, chunks((size_in + CHUNK_SIZE - 1) / CHUNK_SIZE)
+{
+    dispatch();
+}
+
+void parallel_csv::dispatch() {
+    // keep every worker busy, with one batch of slack for the consumer
+    while (pending.size() <= threads && dispatched < chunks) {
+        pending.push_back(std::async(std::launch::async, parse, &file, dispatched++, false, needed));
+    }
+}
+
+parallel_csv::batch_t parallel_csv::parse(const mapped_file_t* file, size_t chunk, bool quoted, std::vector<bool> needed) {
+    batch_t batch;
+    const char* base = file->base;
+    const size_t size = file->size;
+    const size_t start = chunk * CHUNK_SIZE;
+    const size_t end = start + CHUNK_SIZE < size ? start + CHUNK_SIZE : size;
+
+    csv_scan::scanner_t scanner(quoted);
+    std::vector<uint64_t> index;
+    scanner.scan(base + start, end - start, start, index);
+    batch.parity = scanner.in_quotes() != quoted;
+
+    size_t i = 0;
+    size_t pos = 0;
+    if (chunk > 0) {
+        // skip the tail of the row owned by the previous chunk
+        while (i < index.size() && !(index[i] & csv_scan::newline_flag)) ++i;
+        if (i == index.size()) return batch;
+        pos = csv_scan::entry_offset(index[i++]) + 1;
+    }
+
+    size_t scanned = end;
+    while (pos <= end && pos < size) {
+        size_t column = 0;
+        for (;;) {
+            if (i == index.size()) {
+                if (scanned == size) {
+                    project_tail(base, pos, size, column, needed, batch.fields);
+                    pos = size;
+                    break;
+                }
+                // the row continues into the next chunk
+                size_t len = size - scanned < SCAN_CHUNK ? size - scanned : SCAN_CHUNK;
+                index.clear();
+                i = 0;
+                scanner.scan(base + scanned, len, scanned, index);
+                scanned += len;
+                continue;
+            }
+            const uint64_t entry = index[i++];
+            pos = project_field(base, pos, entry, column++, needed, batch.fields);
+            if (entry & csv_scan::newline_flag) break;
+        }
+        batch.ends.push_back(batch.fields.size());
+    }
+    return batch;
+}
+
+bool parallel_csv::read(csv_row_t& row) {
+    row.clear();
+    while (row_index == current.ends.size()) {
+        if (pending.empty()) return false;
+        current = pending.front().get();
+        pending.pop_front();
+        if (quoted) {
+            // the speculation was wrong; this chunk starts inside quotes
+            current = parse(&file, consumed, true, needed);
+        }
+        quoted = quoted != current.parity;
+        file.release(consumed * CHUNK_SIZE);
+        ++consumed;
+        row_index = 0;
+        dispatch();
+    }
+    const size_t begin = row_index ? current.ends[row_index - 1] : 0;
+    row.assign(current.fields.begin() + begin, current.fields.begin() + current.ends[row_index]);
+    ++row_index;
+    return true;
+}
+
+stream_csv::stream_csv(std::unique_ptr<input_t> input_in, size_t slots, size_t chunk_size)
+: input(std::move(input_in))
+, queue(slots, chunk_size)
+{
+    producer = std::thread(&input_t::produce, input.get(), std::ref(queue));
+}
+
+stream_csv::~stream_csv() {
+    queue.cancel();
+    producer.join();
+}
+
+bool stream_csv::fill() {
+    if (!eof) {
+        // drop consumed bytes and entries, so the buffer only grows to fit the longest row
+        if (pos > 0) {
+            memmove(buf.data(), buf.data() + pos, filled - pos);
+            filled -= pos;
+            scanned -= pos;
+            index.erase(index.begin(), index.begin() + cursor);
+            for (auto& entry : index) entry -= uint64_t(pos) << 2;
+            cursor = 0;
+            pos = 0;
+        }
+        const chunk_t* chunk = queue.next();
+        if (chunk) {
+            if (buf.size() < filled + chunk->len) buf.resize(filled + chunk->len);
+            memcpy(buf.data() + filled, chunk->data, chunk->len);
+            filled += chunk->len;
+            queue.release();
+        } else {
+            eof = true;
+        }
+    } else if (scanned == filled) {
+        return false;
+    }
+    // all but the final piece handed to the scanner must be a multiple of 64 bytes
+    size_t len = eof ? filled - scanned : (filled - scanned) & ~size_t(63);
+    scanner.scan(buf.data() + scanned, len, scanned, index);
+    scanned += len;
+    return true;
+}
+
+bool stream_csv::read(csv_row_t& row) {
+    row.clear();
+    // locate the end of the row first, as filling the buffer may move it
+    size_t end = cursor;
+    for (;;) {
+        while (end < index.size() && !(index[end] & csv_scan::newline_flag)) ++end;
+        if (end < index.size()) break;
+        size_t ahead = end - cursor;
+        if (!fill()) break;
+        end = cursor + ahead;
+    }
+    const char* base = buf.data();
+    if (end == index.size()) {
+        // end of input; the remainder (if any) is an unterminated row
+        if (pos >= filled) return false;
+        size_t column = 0;
+        for (; cursor < index.size(); ++cursor) pos = project_field(base, pos, index[cursor], column++, needed, row);
+        project_tail(base, pos, filled, column, needed, row);
+        pos = filled;
+        return true;
+    }
+    size_t column = 0;
+    for (; cursor <= end; ++cursor) pos = project_field(base, pos, index[cursor], column++, needed, row);
+    return true;
 }
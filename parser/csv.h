@@ -1,19 +1,253 @@
 #ifndef included_csv_h_
 #define included_csv_h_
 
+#include <deque>
+#include <future>
+#include <thread>
 #include <vector>
 #include <string>
+#include <memory>
 #include <cstdio>
+#include <cstring>
 
-class csv {
+#include "input.h"
+#include "output.h"
+#include "scan.h"
+
+/**
+ * A field in a CSV row. The field does not own its data; it points into the buffer of the
+ * reader which produced it, and is only valid until the next call to read() on that reader.
+ */
+struct csv_field_t {
+    const char* ptr;
+    size_t len;
+    csv_field_t(const char* ptr_in = nullptr, size_t len_in = 0) : ptr(ptr_in), len(len_in) {}
+    csv_field_t(const std::string& s) : ptr(s.data()), len(s.size()) {}
+    std::string str() const { return std::string(ptr, len); }
+    bool operator==(const char* s) const { return strlen(s) == len && !memcmp(ptr, s, len); }
+};
+
+typedef std::vector<csv_field_t> csv_row_t;
+
+class csv_reader {
+public:
+    virtual ~csv_reader() {}
+    virtual bool read(csv_row_t& row) = 0;
+    // for readers fed by a background thread, get the time spent waiting on it; false otherwise
+    virtual bool io_stats(queue_stats_t& /* stats */) { return false; }
+    /**
+     * Only hand out the columns whose entry in needed_in is set. Fields of other columns preceding
+     * the last needed one are left empty, and the ones following it are left out altogether, so
+     * the remainder of each row is skipped. An empty projection (the default) hands out every
+     * column. Readers may ignore the projection, or apply it only from some row onwards.
+     */
+    void project(std::vector<bool> needed_in);
+    /**
+     * Create a reader for the given file, taking ownership of fp. Uncompressed regular files are
+     * memory mapped, and if threads is greater than 1, large ones are parsed in parallel through a
+     * parallel_csv. With io set to read or direct, they are instead read ahead into large buffers
+     * by a readahead_input. Compressed files (gzip or zstd, detected by their leading bytes) and
+     * anything that cannot be mapped (pipes, character devices, ...) are read through a stream_csv.
+     */
+    static std::unique_ptr<csv_reader> open(FILE* fp, size_t threads = 1, io_mode io = io_mode::mmap);
+protected:
+    std::vector<bool> needed; // the projection; empty if every column is needed
+};
+
+/**
+ * Destination of rows of fields: a csv_writer, or a table_writer. The first row is the header.
+ */
+class row_writer {
+public:
+    virtual ~row_writer() {}
+    virtual void field(const char* s, size_t len) = 0;
+    void field(const std::string& s) { field(s.data(), s.size()); }
+    virtual void field(int64_t v) = 0;
+    virtual void end_row() = 0;
+    void write(const std::vector<std::string>& row);
+    // hint that the given column never needs quoting
+    virtual void set_plain(size_t /* column */, bool /* plain */ = true) {}
+    // flush and close the output; throws on failure
+    virtual void close() = 0;
+
+    /**
+     * Create the appropriate writer for the given path, taking ownership of fp: paths ending in
+     * .cmb get a table_writer, anything else a csv_writer on output_t::open(fp, path, threaded).
+     */
+    static std::unique_ptr<row_writer> open(FILE* fp, const std::string& path, bool threaded = false);
+};
+
+/**
+ * Writer handing every row to each of several writers, e.g. to write identical rows to several
+ * outputs while formatting them only once.
+ */
+class tee_writer: public row_writer {
+public:
+    tee_writer(std::vector<std::unique_ptr<row_writer>> writers_in) : writers(std::move(writers_in)) {}
+    using row_writer::field;
+    void field(const char* s, size_t len) override { for (auto& w : writers) w->field(s, len); }
+    void field(int64_t v) override { for (auto& w : writers) w->field(v); }
+    void end_row() override { for (auto& w : writers) w->end_row(); }
+    void set_plain(size_t column, bool plain = true) override { for (auto& w : writers) w->set_plain(column, plain); }
+    void close() override { for (auto& w : writers) w->close(); }
+private:
+    std::vector<std::unique_ptr<row_writer>> writers;
+};
+
+/**
+ * Buffered CSV writer. Rows are built field by field in a large reusable buffer which is handed
+ * to the output in a few large writes, rather than going through stdio a byte at a time.
+ * Integers are formatted straight into the buffer.
+ * Fields containing a comma are quoted; columns which are known to never contain one can be
+ * marked as plain, skipping the check altogether.
+ */
+class csv_writer: public row_writer {
 public:
+    csv_writer(std::unique_ptr<output_t> out_in, size_t capacity = 1 << 20);
+    ~csv_writer();
+    using row_writer::field;
+    void field(const char* s, size_t len) override;
+    void field(int64_t v) override;
+    void end_row() override;
+    void set_plain(size_t column, bool plain = true) override;
+    void flush();
+    void close() override;
+private:
+    std::unique_ptr<output_t> out;
+    char* buf;
+    size_t cap;
+    size_t len{0};
+    size_t column{0};
+    std::vector<bool> plain;
+    void reserve(size_t bytes);
+};
+
+/**
+ * A read-only mapping of a regular file, taking ownership of fp. The mapping is given sequential
+ * access hints, and pages behind the read position can be released in batches, so that files
+ * larger than physical memory can be read without pushing everything else out; released pages
+ * are simply faulted back in from the file if something still refers to them.
+ */
+struct mapped_file_t {
     FILE* fp;
-    csv(FILE* fp_in) : fp(fp_in) {}
-    ~csv() { fclose(fp); }
-    bool read(std::vector<std::string>& vec);
-    void write(const std::vector<std::string>& vec);
-    static std::string stringify(const std::vector<std::string>& vec);
-    // static void parse(const char* csv, std::vector<std::string>& vec);
+    char* base;
+    size_t size;
+    size_t dropped{0};
+    mapped_file_t(FILE* fp_in, size_t size_in);
+    ~mapped_file_t();
+    // release pages entirely preceding pos
+    void release(size_t pos);
 };
 
+/**
+ * Zero-copy reader for a CSV file held in memory in its entirety. Rows are handed out as fields
+ * pointing directly into the memory. Field boundaries are located ahead of time, a block at a
+ * time, by a csv_scan::scanner_t.
+ */
+class buffer_csv: public csv_reader {
+public:
+    // read the CSV data in data_in, taking ownership of it
+    buffer_csv(std::vector<char> data_in) : data(std::move(data_in)), base(data.data()), size(data.size()) {}
+    bool read(csv_row_t& row) override;
+    // continue reading at offset, which must be the start of a row
+    void seek(size_t offset);
+protected:
+    buffer_csv() {}
+    std::vector<char> data;
+    const char* base{nullptr};
+    size_t size{0};
+    // called before a row starting at pos is handed out, i.e. once everything before pos is done with
+    virtual void consumed(size_t /* pos */) {}
+private:
+    size_t pos{0};
+    size_t scanned{0};
+    csv_scan::scanner_t scanner;
+    std::vector<uint64_t> index;
+    size_t cursor{0};
+};
+
+/**
+ * Zero-copy reader for regular files, which are memory mapped.
+ */
+class mmap_csv: public buffer_csv {
+public:
+    mmap_csv(FILE* fp_in, size_t size_in) : file(fp_in, size_in) { base = file.base; size = file.size; }
+protected:
+    // only pages entirely preceding the row being handed out are released
+    void consumed(size_t pos) override { file.release(pos); }
+private:
+    mapped_file_t file;
+};
+
+/**
+ * Parallel zero-copy reader for large regular files. The file is split into fixed size chunks,
+ * each of which is parsed into a batch of rows on a worker thread, and the batches are handed out
+ * in file order, so the rows are identical to those of an mmap_csv.
+ *
+ * A chunk owns every row which starts after a newline inside of it (the first chunk also owns the
+ * row at offset 0), and its worker scans past the chunk end to complete the last one. Workers
+ * cannot know whether their chunk starts inside quotes, so they speculate that it does not; the
+ * quote parity of each chunk is recorded, and when the batches are consumed in order, any chunk
+ * whose speculation turns out wrong is parsed again with the correct state.
+ */
+class parallel_csv: public csv_reader {
+public:
+    parallel_csv(FILE* fp_in, size_t size_in, size_t threads_in);
+    bool read(csv_row_t& row) override;
+
+    struct batch_t {
+        std::vector<csv_field_t> fields;
+        std::vector<size_t> ends; // for each row, the index one past its last field
+        bool parity{false};       // whether the chunk holds an odd number of quotes
+    };
+    static const size_t CHUNK_SIZE = 4 << 20;
+private:
+    mapped_file_t file; // must outlive pending
+    size_t threads;
+    size_t chunks;
+    size_t dispatched{0};
+    size_t consumed{0};
+    bool quoted{false}; // actual quote state at the start of the next chunk to be consumed
+    std::deque<std::future<batch_t>> pending;
+    batch_t current;
+    size_t row_index{0};
+
+    void dispatch();
+    static batch_t parse(const mapped_file_t* file, size_t chunk, bool quoted, std::vector<bool> needed);
+};
+
+/**
+ * Reader for inputs which arrive as a stream of chunks, produced by an input_t running on its own
+ * thread (e.g. decompressing a gzip file). Chunks are appended to an internal buffer and scanned
+ * as they arrive; rows point into this buffer, so they are only valid until the next read().
+ */
+class stream_csv: public csv_reader {
+public:
+    stream_csv(std::unique_ptr<input_t> input_in, size_t slots = 4, size_t chunk_size = 1 << 20);
+    ~stream_csv();
+    bool read(csv_row_t& row) override;
+    bool io_stats(queue_stats_t& stats) override { stats = queue.stats(); return true; }
+private:
+    std::unique_ptr<input_t> input;
+    chunk_queue_t queue;
+    std::thread producer;
+    std::vector<char> buf;
+    size_t filled{0};
+    size_t pos{0};
+    size_t scanned{0};
+    bool eof{false};
+    csv_scan::scanner_t scanner;
+    std::vector<uint64_t> index;
+    size_t cursor{0};
+
+    // append the next chunk (if any) to the buffer and scan it; returns false if nothing was left
+    bool fill();
+};
+
+/**
+ * Parse a single row starting at pos, not going past end. Returns the position following the
+ * row's terminating newline (or end, if the row was not terminated).
+ */
+const char* csv_parse_row(const char* pos, const char* end, csv_row_t& row);
+
 #endif // included_csv_h_
@@ -0,0 +1,198 @@
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "input.h"
+
+static const unsigned char GZIP_MAGIC[] = { 0x1f, 0x8b };
+static const unsigned char ZSTD_MAGIC[] = { 0x28, 0xb5, 0x2f, 0xfd };
+
+// compressed data is read from the file this many bytes at a time
+static const size_t COMPRESSED_READ_SIZE = 256 << 10;
+
+bool input_t::compressed(const unsigned char* magic, size_t len) {
+    return (len >= sizeof(GZIP_MAGIC) && !memcmp(magic, GZIP_MAGIC, sizeof(GZIP_MAGIC)))
+        || (len >= sizeof(ZSTD_MAGIC) && !memcmp(magic, ZSTD_MAGIC, sizeof(ZSTD_MAGIC)));
+}
+
+std::unique_ptr<input_t> input_t::open(FILE* fp, const unsigned char* magic, size_t len) {
+    // a hint only; fails harmlessly for pipes
+    posix_fadvise(fileno(fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (len >= sizeof(GZIP_MAGIC) && !memcmp(magic, GZIP_MAGIC, sizeof(GZIP_MAGIC))) {
+        return std::unique_ptr<input_t>(new gzip_input(fp, magic, len));
+    }
+    if (len >= sizeof(ZSTD_MAGIC) && !memcmp(magic, ZSTD_MAGIC, sizeof(ZSTD_MAGIC))) {
+#ifdef HAVE_ZSTD
+        return std::unique_ptr<input_t>(new zstd_input(fp, magic, len));
+#else
+        fclose(fp);
+        throw std::runtime_error("input is zstd compressed, but zstd support is not compiled in (build with -DHAVE_ZSTD -lzstd)");
+#endif
+    }
+    return std::unique_ptr<input_t>(new plain_input(fp, magic, len));
+}
+
+size_t input_t::fill(unsigned char* dst, size_t len) {
+    size_t from_prefix = prefix.size() < len ? prefix.size() : len;
+    if (from_prefix > 0) {
+        memcpy(dst, prefix.data(), from_prefix);
+        prefix.erase(prefix.begin(), prefix.begin() + from_prefix);
+    }
+    return from_prefix + fread(dst + from_prefix, 1, len - from_prefix, fp);
+}
+
+void plain_input::produce(chunk_queue_t& queue) {
+    for (;;) {
+        chunk_t* c = queue.acquire();
+        if (!c) return;
+        c->len = fill((unsigned char*)c->data, c->size);
+        if (c->len == 0) break;
+        queue.commit();
+    }
+    queue.close(ferror(fp) ? "failed to read input" : "");
+}
+
+// switch O_DIRECT on or off for fd; returns false if that is not possible
+static bool set_direct(int fd, bool on) {
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0) return false;
+    return 0 == fcntl(fd, F_SETFL, on ? flags | O_DIRECT : flags & ~O_DIRECT);
+}
+
+void readahead_input::produce(chunk_queue_t& queue) {
+    int fd = fileno(fp);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (direct && !set_direct(fd, true)) {
+        fprintf(stderr, "warning: O_DIRECT not supported for input; using buffered reads\n");
+        direct = false;
+    }
+    std::string error;
+    off_t offset = 0;
+    bool done = false;
+    while (!done) {
+        chunk_t* c = queue.acquire();
+        if (!c) break;
+        while (c->len < c->size) {
+            ssize_t n = pread(fd, c->data + c->len, c->size - c->len, offset);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                if (errno == EINVAL && direct) {
+                    // the file system rejected the direct read (e.g. alignment); carry on buffered
+                    set_direct(fd, false);
+                    direct = false;
+                    continue;
+                }
+                error = std::string("failed to read input: ") + strerror(errno);
+                done = true;
+                break;
+            }
+            if (n == 0) {
+                done = true;
+                break;
+            }
+            c->len += n;
+            offset += n;
+        }
+        if (c->len > 0) queue.commit();
+    }
+    if (direct) set_direct(fd, false);
+    queue.close(error);
+}
+
+void gzip_input::produce(chunk_queue_t& queue) {
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    // 15 window bits, +32 to accept both gzip and zlib headers
+    if (Z_OK != inflateInit2(&zs, 15 + 32)) {
+        queue.close("failed to initialize gzip decompression");
+        return;
+    }
+    std::vector<unsigned char> in(COMPRESSED_READ_SIZE);
+    std::string error;
+    bool done = false;
+    while (!done) {
+        chunk_t* c = queue.acquire();
+        if (!c) break;
+        zs.next_out = (Bytef*)c->data;
+        zs.avail_out = c->size;
+        while (zs.avail_out > 0) {
+            if (zs.avail_in == 0) {
+                zs.avail_in = fill(in.data(), in.size());
+                zs.next_in = in.data();
+                if (zs.avail_in == 0) {
+                    // input ended before the end of the gzip stream
+                    error = "truncated gzip input";
+                    done = true;
+                    break;
+                }
+            }
+            int rv = inflate(&zs, Z_NO_FLUSH);
+            if (rv == Z_STREAM_END) {
+                // gzip files may consist of several concatenated members
+                if (zs.avail_in == 0) {
+                    zs.avail_in = fill(in.data(), in.size());
+                    zs.next_in = in.data();
+                }
+                if (zs.avail_in == 0) {
+                    done = true;
+                    break;
+                }
+                inflateReset(&zs);
+            } else if (rv != Z_OK && rv != Z_BUF_ERROR) {
+                error = std::string("gzip decompression failed: ") + (zs.msg ? zs.msg : "unknown error");
+                done = true;
+                break;
+            }
+        }
+        c->len = c->size - zs.avail_out;
+        if (c->len > 0) queue.commit();
+    }
+    inflateEnd(&zs);
+    queue.close(error);
+}
+
+#ifdef HAVE_ZSTD
+void zstd_input::produce(chunk_queue_t& queue) {
+    ZSTD_DStream* zds = ZSTD_createDStream();
+    ZSTD_initDStream(zds);
+    std::vector<unsigned char> in(COMPRESSED_READ_SIZE);
+    ZSTD_inBuffer zin = { in.data(), 0, 0 };
+    std::string error;
+    size_t hint = 1; // non-zero while a frame is incomplete
+    bool done = false;
+    while (!done) {
+        chunk_t* c = queue.acquire();
+        if (!c) break;
+        ZSTD_outBuffer zout = { c->data, c->size, 0 };
+        while (zout.pos < zout.size) {
+            if (zin.pos == zin.size) {
+                zin.size = fill(in.data(), in.size());
+                zin.pos = 0;
+                if (zin.size == 0) {
+                    if (hint != 0) error = "truncated zstd input";
+                    done = true;
+                    break;
+                }
+            }
+            hint = ZSTD_decompressStream(zds, &zout, &zin);
+            if (ZSTD_isError(hint)) {
+                error = std::string("zstd decompression failed: ") + ZSTD_getErrorName(hint);
+                done = true;
+                break;
+            }
+        }
+        c->len = zout.pos;
+        if (c->len > 0) queue.commit();
+    }
+    ZSTD_freeDStream(zds);
+    queue.close(error);
+}
+#endif // HAVE_ZSTD
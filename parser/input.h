@@ -0,0 +1,94 @@
+#ifndef included_input_h_
+#define included_input_h_
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstdio>
+
+#include "queue.h"
+
+/**
+ * How uncompressed regular files are read.
+ */
+enum class io_mode {
+    // memory mapped, and parsed in place
+    mmap,
+    // read ahead into large buffers on a background thread
+    read,
+    // as read, but bypassing the page cache using O_DIRECT, where supported
+    direct,
+};
+
+inline io_mode parse_io_mode(const std::string& mode) {
+    if (mode == "mmap") return io_mode::mmap;
+    if (mode == "read") return io_mode::read;
+    if (mode == "direct") return io_mode::direct;
+    throw std::runtime_error("unknown I/O mode " + mode);
+}
+
+/**
+ * A source of raw CSV bytes, which is run on its own thread and feeds a chunk_queue_t.
+ * Inputs take ownership of their FILE*. Since the first few bytes of the file have already been
+ * consumed to detect the input type, they are passed in as a prefix.
+ */
+class input_t {
+public:
+    input_t(FILE* fp_in, const unsigned char* prefix_in, size_t prefix_len) : fp(fp_in), prefix(prefix_in, prefix_in + prefix_len) {}
+    virtual ~input_t() { fclose(fp); }
+    // fill the queue until the input is exhausted, and close it
+    virtual void produce(chunk_queue_t& queue) = 0;
+
+    static const size_t MAGIC_LEN = 4;
+    // whether the given leading bytes of a file indicate a compressed format
+    static bool compressed(const unsigned char* magic, size_t len);
+    // create the appropriate input for the file, given its leading bytes
+    static std::unique_ptr<input_t> open(FILE* fp, const unsigned char* magic, size_t len);
+protected:
+    FILE* fp;
+    std::vector<unsigned char> prefix;
+    // read up to len bytes, prefix first
+    size_t fill(unsigned char* dst, size_t len);
+};
+
+class plain_input: public input_t {
+public:
+    using input_t::input_t;
+    void produce(chunk_queue_t& queue) override;
+};
+
+class gzip_input: public input_t {
+public:
+    using input_t::input_t;
+    void produce(chunk_queue_t& queue) override;
+};
+
+/**
+ * Read-ahead input for uncompressed regular files. The file is read from the start with pread(2),
+ * one whole chunk at a time, so with a few large chunks in the queue, the reads are always a
+ * buffer or two ahead of the parser. The kernel is told that the file is read sequentially, and
+ * if direct is set, the file is read with O_DIRECT, falling back to buffered reads if the file
+ * system does not support it. The stdio position of fp is ignored, so no prefix is needed.
+ */
+class readahead_input: public input_t {
+public:
+    readahead_input(FILE* fp_in, bool direct_in) : input_t(fp_in, nullptr, 0), direct(direct_in) {}
+    void produce(chunk_queue_t& queue) override;
+
+    // triple buffering, with chunks large enough to keep the device busy
+    static const size_t SLOTS = 3;
+    static const size_t CHUNK_SIZE = 8 << 20;
+private:
+    bool direct;
+};
+
+#ifdef HAVE_ZSTD
+class zstd_input: public input_t {
+public:
+    using input_t::input_t;
+    void produce(chunk_queue_t& queue) override;
+};
+#endif // HAVE_ZSTD
+
+#endif // included_input_h_
@@ -0,0 +1,24 @@
+#include "number.h"
+
+namespace number {
+
+bool parse(const char* s, size_t len, int64_t& v) {
+    if (len == 0) return false;
+    uint64_t n = 0;
+    bool integral = true;
+    for (size_t i = 0; i < len; ++i) {
+        if (integral && s[i] == '.') {
+            integral = false;
+            continue;
+        }
+        if (s[i] < '0' || s[i] > '9') return false;
+        if (!integral) continue;
+        uint64_t d = s[i] - '0';
+        if (n > (uint64_t(INT64_MAX) - d) / 10) return false;
+        n = n * 10 + d;
+    }
+    v = n;
+    return true;
+}
+
+} // namespace number
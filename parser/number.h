@@ -0,0 +1,19 @@
+#ifndef included_number_h_
+#define included_number_h_
+
+#include <cstdint>
+#include <cstddef>
+
+namespace number {
+
+/**
+ * Numeric cells are runs of digits with at most one decimal point (e.g. "42" or "33.94"), whose
+ * value is their integer part. parse() validates a cell and converts it in one pass. It is false
+ * if the cell is not numeric, or if its integer part does not fit in an int64_t, in which case v
+ * is left untouched.
+ */
+bool parse(const char* s, size_t len, int64_t& v);
+
+} // namespace number
+
+#endif // included_number_h_
@@ -0,0 +1,178 @@
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+#include <zlib.h>
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "output.h"
+
+static inline bool ends_with(const std::string& s, const char* suffix) {
+    size_t len = strlen(suffix);
+    return s.size() >= len && s.compare(s.size() - len, len, suffix) == 0;
+}
+
+class gzip_codec: public codec_t {
+public:
+    gzip_codec() {
+        memset(&zs, 0, sizeof(zs));
+        // 15 window bits, +16 for a gzip (rather than zlib) header
+        if (Z_OK != deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY)) {
+            throw std::runtime_error("failed to initialize gzip compression");
+        }
+    }
+    ~gzip_codec() { deflateEnd(&zs); }
+    void compress(const char* data, size_t len, bool finish, std::vector<char>& out) override {
+        zs.next_in = (Bytef*)data;
+        zs.avail_in = len;
+        int rv;
+        do {
+            size_t at = out.size();
+            out.resize(at + deflateBound(&zs, zs.avail_in) + 64);
+            zs.next_out = (Bytef*)out.data() + at;
+            zs.avail_out = out.size() - at;
+            rv = deflate(&zs, finish ? Z_FINISH : Z_NO_FLUSH);
+            if (rv == Z_STREAM_ERROR) throw std::runtime_error("gzip compression failed");
+            out.resize(out.size() - zs.avail_out);
+        } while (zs.avail_in > 0 || (finish && rv != Z_STREAM_END));
+    }
+private:
+    z_stream zs;
+};
+
+#ifdef HAVE_ZSTD
+class zstd_codec: public codec_t {
+public:
+    zstd_codec() {
+        zcs = ZSTD_createCStream();
+        ZSTD_initCStream(zcs, ZSTD_CLEVEL_DEFAULT);
+    }
+    ~zstd_codec() { ZSTD_freeCStream(zcs); }
+    void compress(const char* data, size_t len, bool finish, std::vector<char>& out) override {
+        ZSTD_inBuffer zin = { data, len, 0 };
+        size_t remaining;
+        do {
+            size_t at = out.size();
+            out.resize(at + ZSTD_CStreamOutSize());
+            ZSTD_outBuffer zout = { out.data() + at, out.size() - at, 0 };
+            remaining = finish ? ZSTD_compressStream2(zcs, &zout, &zin, ZSTD_e_end) : ZSTD_compressStream2(zcs, &zout, &zin, ZSTD_e_continue);
+            if (ZSTD_isError(remaining)) throw std::runtime_error(std::string("zstd compression failed: ") + ZSTD_getErrorName(remaining));
+            out.resize(at + zout.pos);
+        } while (zin.pos < zin.size || (finish && remaining > 0));
+    }
+private:
+    ZSTD_CStream* zcs;
+};
+#endif // HAVE_ZSTD
+
+// the identity "compression", for outputs which are only written on a thread of their own
+class copy_codec: public codec_t {
+public:
+    void compress(const char* data, size_t len, bool /* finish */, std::vector<char>& out) override {
+        out.insert(out.end(), data, data + len);
+    }
+};
+
+std::unique_ptr<output_t> output_t::open(FILE* fp, const std::string& path, bool threaded) {
+    if (ends_with(path, ".gz")) {
+        return std::unique_ptr<output_t>(new compressed_output(fp, std::unique_ptr<codec_t>(new gzip_codec())));
+    }
+    if (ends_with(path, ".zst")) {
+#ifdef HAVE_ZSTD
+        return std::unique_ptr<output_t>(new compressed_output(fp, std::unique_ptr<codec_t>(new zstd_codec())));
+#else
+        fclose(fp);
+        throw std::runtime_error("zstd output requested, but zstd support is not compiled in (build with -DHAVE_ZSTD -lzstd)");
+#endif
+    }
+    if (threaded) {
+        return std::unique_ptr<output_t>(new compressed_output(fp, std::unique_ptr<codec_t>(new copy_codec())));
+    }
+    return std::unique_ptr<output_t>(new output_t(fp));
+}
+
+void output_t::write_fd(const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t written = ::write(fileno(fp), data, len);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            throw std::runtime_error(std::string("failed to write output: ") + strerror(errno));
+        }
+        data += written;
+        len -= written;
+    }
+}
+
+void output_t::write(const char* data, size_t len) {
+    write_fd(data, len);
+}
+
+void output_t::close() {
+    if (!fp) return;
+    int rv = fclose(fp);
+    fp = nullptr;
+    if (rv) throw std::runtime_error(std::string("failed to close output: ") + strerror(errno));
+}
+
+compressed_output::compressed_output(FILE* fp_in, std::unique_ptr<codec_t> codec_in)
+: output_t(fp_in)
+, codec(std::move(codec_in))
+{
+    compressor = std::thread(&compressed_output::run, this);
+}
+
+compressed_output::~compressed_output() {
+    if (!closed) queue.close();
+    if (compressor.joinable()) compressor.join();
+}
+
+void compressed_output::run() {
+    std::vector<char> out;
+    try {
+        for (;;) {
+            const chunk_t* c = queue.next();
+            out.clear();
+            codec->compress(c ? c->data : nullptr, c ? c->len : 0, !c, out);
+            if (c) queue.release();
+            write_fd(out.data(), out.size());
+            if (!c) return;
+        }
+    } catch (const std::exception& e) {
+        // the writer picks this up the next time it fails to acquire a chunk, or on close()
+        error = e.what();
+        queue.cancel();
+    }
+}
+
+void compressed_output::write(const char* data, size_t len) {
+    while (len > 0) {
+        if (!chunk) {
+            chunk = queue.acquire();
+            if (!chunk) throw std::runtime_error(error);
+        }
+        size_t n = chunk->size - chunk->len;
+        if (n > len) n = len;
+        memcpy(chunk->data + chunk->len, data, n);
+        chunk->len += n;
+        data += n;
+        len -= n;
+        if (chunk->len == chunk->size) {
+            queue.commit();
+            chunk = nullptr;
+        }
+    }
+}
+
+void compressed_output::close() {
+    if (closed) return;
+    closed = true;
+    if (chunk && chunk->len > 0) queue.commit();
+    chunk = nullptr;
+    queue.close();
+    compressor.join();
+    if (error.size() > 0) throw std::runtime_error(error);
+    output_t::close();
+}
@@ -0,0 +1,79 @@
+#ifndef included_output_h_
+#define included_output_h_
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+
+#include "queue.h"
+
+/**
+ * Destination of the bytes produced by a csv_writer. Outputs take ownership of their FILE*, but
+ * write to its file descriptor directly. The plain output writes everything through as is.
+ */
+class output_t {
+public:
+    output_t(FILE* fp_in) : fp(fp_in) {}
+    virtual ~output_t() { if (fp) fclose(fp); }
+    virtual void write(const char* data, size_t len);
+    // flush everything and close the file; throws on failure
+    virtual void close();
+
+    /**
+     * Create the appropriate output for the given path: paths ending in .gz or .zst are compressed
+     * on a background thread, anything else is written as is; on a background thread of its own,
+     * if threaded is set.
+     */
+    static std::unique_ptr<output_t> open(FILE* fp, const std::string& path, bool threaded = false);
+protected:
+    FILE* fp;
+    void write_fd(const char* data, size_t len);
+};
+
+/**
+ * Output which collects everything written to it in memory, e.g. to format part of a file on
+ * another thread, to be written out later.
+ */
+class buffer_output: public output_t {
+public:
+    std::string buf;
+    buffer_output() : output_t(nullptr) {}
+    void write(const char* data, size_t len) override { buf.append(data, len); }
+    void close() override {}
+};
+
+/**
+ * A compression format for a compressed_output. compress() appends compressed data for the given
+ * input to out, and when finish is set, also ends the stream.
+ */
+class codec_t {
+public:
+    virtual ~codec_t() {}
+    virtual void compress(const char* data, size_t len, bool finish, std::vector<char>& out) = 0;
+};
+
+/**
+ * Output which compresses on a dedicated thread. Written data is copied into a chunk_queue_t, and
+ * the compressor thread compresses and writes it out, so formatting rows never waits for the
+ * compressor unless the queue is full.
+ */
+class compressed_output: public output_t {
+public:
+    compressed_output(FILE* fp_in, std::unique_ptr<codec_t> codec_in);
+    ~compressed_output();
+    void write(const char* data, size_t len) override;
+    void close() override;
+private:
+    std::unique_ptr<codec_t> codec;
+    chunk_queue_t queue;
+    std::thread compressor;
+    chunk_t* chunk{nullptr}; // chunk being filled, if any
+    std::string error;       // set by the compressor thread if it fails
+    bool closed{false};
+
+    void run();
+};
+
+#endif // included_output_h_
@@ -0,0 +1,79 @@
+#include <chrono>
+#include <stdexcept>
+#include <cstdlib>
+
+#include "queue.h"
+
+typedef std::chrono::steady_clock queue_clock;
+
+// wait on cv until ready() holds, adding the time spent blocked (if any) to waits and wait_ns
+template<typename Pred>
+static inline void timed_wait(std::condition_variable& cv, std::unique_lock<std::mutex>& lock, Pred ready, size_t& waits, uint64_t& wait_ns) {
+    if (ready()) return;
+    auto start = queue_clock::now();
+    cv.wait(lock, ready);
+    ++waits;
+    wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(queue_clock::now() - start).count();
+}
+
+chunk_queue_t::chunk_queue_t(size_t slots, size_t chunk_size) : ring(slots) {
+    for (auto& c : ring) {
+        void* data;
+        if (posix_memalign(&data, CHUNK_ALIGN, chunk_size)) throw std::bad_alloc();
+        c.data = (char*)data;
+        c.size = chunk_size;
+    }
+}
+
+chunk_queue_t::~chunk_queue_t() {
+    for (auto& c : ring) free(c.data);
+}
+
+chunk_t* chunk_queue_t::acquire() {
+    std::unique_lock<std::mutex> lock(mtx);
+    timed_wait(emptied_cv, lock, [this] { return cancelled || count < ring.size(); }, counters.producer_waits, counters.producer_wait_ns);
+    if (cancelled) return nullptr;
+    chunk_t* c = &ring[(head + count) % ring.size()];
+    c->len = 0;
+    return c;
+}
+
+void chunk_queue_t::commit() {
+    std::lock_guard<std::mutex> lock(mtx);
+    ++count;
+    ++counters.chunks;
+    filled_cv.notify_one();
+}
+
+void chunk_queue_t::close(const std::string& error_in) {
+    std::lock_guard<std::mutex> lock(mtx);
+    closed = true;
+    error = error_in;
+    filled_cv.notify_one();
+}
+
+const chunk_t* chunk_queue_t::next() {
+    std::unique_lock<std::mutex> lock(mtx);
+    timed_wait(filled_cv, lock, [this] { return closed || count > 0; }, counters.consumer_waits, counters.consumer_wait_ns);
+    if (count > 0) return &ring[head];
+    if (error.size() > 0) throw std::runtime_error(error);
+    return nullptr;
+}
+
+void chunk_queue_t::release() {
+    std::lock_guard<std::mutex> lock(mtx);
+    head = (head + 1) % ring.size();
+    --count;
+    emptied_cv.notify_one();
+}
+
+void chunk_queue_t::cancel() {
+    std::lock_guard<std::mutex> lock(mtx);
+    cancelled = true;
+    emptied_cv.notify_one();
+}
+
+queue_stats_t chunk_queue_t::stats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return counters;
+}
@@ -0,0 +1,74 @@
+#ifndef included_queue_h_
+#define included_queue_h_
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstdint>
+
+/**
+ * A buffer in a chunk_queue_t. The data is aligned to CHUNK_ALIGN bytes, so that it may be used
+ * for O_DIRECT reads.
+ */
+struct chunk_t {
+    char* data{nullptr};
+    size_t size{0}; // capacity of data
+    size_t len{0};  // bytes filled
+};
+
+static const size_t CHUNK_ALIGN = 4096;
+
+/**
+ * Time spent blocked on a chunk_queue_t. The consumer waits when the producer has not filled the
+ * next chunk yet (i.e. it is waiting for I/O or decompression), and the producer waits when all
+ * chunks are full (i.e. it is ahead of the consumer).
+ */
+struct queue_stats_t {
+    size_t chunks{0};           // chunks passed through the queue
+    size_t consumer_waits{0};
+    uint64_t consumer_wait_ns{0};
+    size_t producer_waits{0};
+    uint64_t producer_wait_ns{0};
+};
+
+/**
+ * Bounded ring of byte chunks, passed from a single producer thread to a single consumer thread
+ * (e.g. from a decompressing input_t to the parser, or from a csv_writer to a compressing output).
+ * The producer blocks while all chunks are filled, and the consumer blocks while all are empty,
+ * so memory use is fixed at slots * chunk_size bytes however large the input is.
+ */
+class chunk_queue_t {
+public:
+    chunk_queue_t(size_t slots = 4, size_t chunk_size = 1 << 20);
+    ~chunk_queue_t();
+    chunk_queue_t(const chunk_queue_t&) = delete;
+    chunk_queue_t& operator=(const chunk_queue_t&) = delete;
+
+    // producer: get the next empty chunk (nullptr if the consumer is gone), and publish it when filled
+    chunk_t* acquire();
+    void commit();
+    // producer: no more chunks will be committed; if error is set, the consumer throws it
+    void close(const std::string& error = "");
+
+    // consumer: get the next filled chunk (nullptr at the end), and hand it back when done with it
+    const chunk_t* next();
+    void release();
+    // consumer: stop the producer, e.g. because the reader is being destroyed or the output failed
+    void cancel();
+
+    queue_stats_t stats();
+
+private:
+    std::vector<chunk_t> ring;
+    size_t head{0};  // next chunk to consume
+    size_t count{0}; // number of filled chunks
+    bool closed{false};
+    bool cancelled{false};
+    std::string error;
+    queue_stats_t counters;
+    std::mutex mtx;
+    std::condition_variable filled_cv, emptied_cv;
+};
+
+#endif // included_queue_h_
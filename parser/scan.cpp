@@ -0,0 +1,146 @@
+#include <cstring>
+
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+namespace csv_scan {
+
+struct masks_t {
+    uint64_t comma, quote, newline;
+};
+
+typedef void (*classify_fn)(const char* block, masks_t& m);
+
+#ifdef __SSE2__
+static inline uint64_t sse2_mask(const __m128i chunks[4], char ch) {
+    const __m128i needle = _mm_set1_epi8(ch);
+    uint64_t r0 = uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunks[0], needle)));
+    uint64_t r1 = uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunks[1], needle)));
+    uint64_t r2 = uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunks[2], needle)));
+    uint64_t r3 = uint16_t(_mm_movemask_epi8(_mm_cmpeq_epi8(chunks[3], needle)));
+    return r0 | (r1 << 16) | (r2 << 32) | (r3 << 48);
+}
+
+static void classify_sse2(const char* block, masks_t& m) {
+    __m128i chunks[4];
+    for (int i = 0; i < 4; ++i) chunks[i] = _mm_loadu_si128((const __m128i*)(block + 16 * i));
+    m.comma = sse2_mask(chunks, ',');
+    m.quote = sse2_mask(chunks, '"');
+    m.newline = sse2_mask(chunks, '\n');
+}
+
+__attribute__((target("avx2")))
+static inline uint64_t avx2_mask(__m256i lo, __m256i hi, char ch) {
+    const __m256i needle = _mm256_set1_epi8(ch);
+    uint64_t r0 = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, needle)));
+    uint64_t r1 = uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, needle)));
+    return r0 | (r1 << 32);
+}
+
+__attribute__((target("avx2")))
+static void classify_avx2(const char* block, masks_t& m) {
+    const __m256i lo = _mm256_loadu_si256((const __m256i*)block);
+    const __m256i hi = _mm256_loadu_si256((const __m256i*)(block + 32));
+    m.comma = avx2_mask(lo, hi, ',');
+    m.quote = avx2_mask(lo, hi, '"');
+    m.newline = avx2_mask(lo, hi, '\n');
+}
+#else
+static void classify_scalar(const char* block, masks_t& m) {
+    m.comma = m.quote = m.newline = 0;
+    for (int i = 0; i < 64; ++i) {
+        const uint64_t bit = uint64_t(1) << i;
+        switch (block[i]) {
+        case ',':  m.comma |= bit; break;
+        case '"':  m.quote |= bit; break;
+        case '\n': m.newline |= bit; break;
+        default: break;
+        }
+    }
+}
+#endif // __SSE2__
+
+static classify_fn select_kernel(const char*& name) {
+#ifdef __SSE2__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        name = "avx2";
+        return classify_avx2;
+    }
+    name = "sse2";
+    return classify_sse2;
+#else
+    name = "scalar";
+    return classify_scalar;
+#endif
+}
+
+static const char* selected_name = nullptr;
+static const classify_fn classify = select_kernel(selected_name);
+
+const char* kernel_name() { return selected_name; }
+
+// bit i of the result is the XOR of bits 0..i of x
+static inline uint64_t prefix_xor(uint64_t x) {
+    x ^= x << 1;
+    x ^= x << 2;
+    x ^= x << 4;
+    x ^= x << 8;
+    x ^= x << 16;
+    x ^= x << 32;
+    return x;
+}
+
+void scanner_t::scan(const char* buf, size_t len, uint64_t base_offset, std::vector<uint64_t>& out) {
+    masks_t m;
+    char padded[64];
+    for (size_t at = 0; at < len; at += 64) {
+        const char* block = buf + at;
+        if (len - at < 64) {
+            memset(padded, 0, 64);
+            memcpy(padded, block, len - at);
+            block = padded;
+        }
+        classify(block, m);
+
+        // a bit is set in inside for every byte that is within quotes (including opening quotes)
+        const uint64_t inside = prefix_xor(m.quote) ^ quoted;
+        quoted = uint64_t(int64_t(inside) >> 63);
+
+        uint64_t separators = (m.comma | m.newline) & ~inside;
+        uint64_t quotes = m.quote;
+        if (!separators) {
+            pending = pending || quotes != 0;
+            continue;
+        }
+        size_t n = out.size();
+        out.resize(n + __builtin_popcountll(separators));
+        uint64_t* dst = &out[n];
+        const uint64_t offset = (base_offset + at) << 2;
+        if (!quotes && !pending) {
+            // common case: no quotes anywhere near
+            do {
+                const int i = __builtin_ctzll(separators);
+                *dst++ = (offset + (uint64_t(i) << 2)) | ((m.newline >> i) & 1);
+                separators &= separators - 1;
+            } while (separators);
+            continue;
+        }
+        do {
+            const int i = __builtin_ctzll(separators);
+            const uint64_t below = (uint64_t(1) << i) - 1;
+            uint64_t entry = (offset + (uint64_t(i) << 2)) | ((m.newline >> i) & 1);
+            if (pending || (quotes & below)) entry |= crop_flag;
+            *dst++ = entry;
+            quotes &= ~below;
+            pending = false;
+            separators &= separators - 1;
+        } while (separators);
+        pending = quotes != 0;
+    }
+}
+
+} // namespace csv_scan
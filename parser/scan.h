@@ -0,0 +1,49 @@
+#ifndef included_scan_h_
+#define included_scan_h_
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace csv_scan {
+
+/**
+ * Each structural character (an unquoted ',' or '\n') found by the scanner is recorded as an
+ * entry: the absolute offset of the character, shifted left by 2, combined with the flags below.
+ */
+static const uint64_t newline_flag = 1; // the separator ends the row
+static const uint64_t crop_flag    = 2; // the field ending here contained quotes, which are cropped
+
+inline uint64_t entry_offset(uint64_t entry) { return entry >> 2; }
+
+/**
+ * Vectorized scanner for CSV structural characters. Input is classified 64 bytes at a time into
+ * comma, quote and newline bitmasks (using AVX2 if the CPU supports it, SSE2 otherwise), quoted
+ * regions are masked out using a prefix XOR over the quote mask, and the remaining separators
+ * are emitted as entries. Quote state carries over between calls, so a file may be scanned in
+ * any number of consecutive pieces.
+ */
+class scanner_t {
+public:
+    scanner_t(bool quoted_in = false) : quoted(quoted_in ? ~uint64_t(0) : 0) {}
+    /**
+     * Scan len bytes at buf, whose first byte is at absolute offset base_offset, appending
+     * entries to out. All but the final piece of a file must have a length that is a multiple of
+     * 64 bytes.
+     */
+    void scan(const char* buf, size_t len, uint64_t base_offset, std::vector<uint64_t>& out);
+    /** Whether the last scanned byte was inside quotes. */
+    bool in_quotes() const { return quoted != 0; }
+    /** Whether a quote has been seen since the last separator. */
+    bool quote_pending() const { return pending; }
+private:
+    uint64_t quoted;
+    bool pending{false};
+};
+
+/** Name of the classification kernel in use ("avx2", "sse2" or "scalar"). */
+const char* kernel_name();
+
+} // namespace csv_scan
+
+#endif // included_scan_h_
@@ -0,0 +1,191 @@
+#include <stdexcept>
+
+#include <sys/stat.h>
+
+#include "table.h"
+
+static const char TABLE_MAGIC[8] = { 'C', 'M', 'T', 'A', 'B', 'L', 'E', '1' };
+
+// parse s as an integer which is written exactly as csv_writer would write it (no sign, leading
+// zeroes or whitespace that would be lost), so that storing the number loses nothing
+static bool plain_integer(const char* s, size_t len, int64_t& v) {
+    bool negative = len > 0 && s[0] == '-';
+    size_t i = negative;
+    // 18 digits always fit
+    if (len == i || len - i > 18 || (s[i] == '0' && (len - i > 1 || negative))) return false;
+    int64_t n = 0;
+    for (; i < len; ++i) {
+        if (s[i] < '0' || s[i] > '9') return false;
+        n = n * 10 + (s[i] - '0');
+    }
+    v = negative ? -n : n;
+    return true;
+}
+
+uint32_t table_writer::column_t::code(const char* s, size_t len) {
+    auto it = index.emplace(std::string(s, len), uint32_t(dict.size()));
+    if (it.second) dict.push_back(it.first->first);
+    return it.first->second;
+}
+
+void table_writer::column_t::demote() {
+    numeric = false;
+    codes.reserve(numbers.size());
+    for (int64_t n : numbers) {
+        std::string s = std::to_string(n);
+        codes.push_back(code(s.data(), s.size()));
+    }
+    numbers = std::vector<int64_t>();
+}
+
+table_writer::column_t& table_writer::next_column() {
+    if (column == columns.size()) {
+        if (!header) throw std::runtime_error("table row has more fields than the header");
+        columns.emplace_back();
+    }
+    return columns[column++];
+}
+
+void table_writer::field(const char* s, size_t len) {
+    column_t& c = next_column();
+    if (header) {
+        c.name.assign(s, len);
+        return;
+    }
+    int64_t v;
+    if (c.numeric && plain_integer(s, len, v)) {
+        c.numbers.push_back(v);
+        return;
+    }
+    if (c.numeric) c.demote();
+    c.codes.push_back(c.code(s, len));
+}
+
+void table_writer::field(int64_t v) {
+    column_t& c = next_column();
+    if (header) {
+        c.name = std::to_string(v);
+        return;
+    }
+    if (c.numeric) {
+        c.numbers.push_back(v);
+        return;
+    }
+    std::string s = std::to_string(v);
+    c.codes.push_back(c.code(s.data(), s.size()));
+}
+
+void table_writer::end_row() {
+    // short rows are padded with empty cells
+    while (!header && column < columns.size()) field("", 0);
+    column = 0;
+    rows += !header;
+    header = false;
+}
+
+static inline void put_u64(std::string& buf, uint64_t v) {
+    buf.append((const char*)&v, sizeof(v));
+}
+
+// append the len bytes at data, and the padding bringing buf to a multiple of 8 bytes
+static inline void put_bytes(std::string& buf, const void* data, size_t len) {
+    buf.append((const char*)data, len);
+    buf.append((8 - buf.size() % 8) % 8, '\0');
+}
+
+void table_writer::close() {
+    if (closed) return;
+    closed = true;
+    if (column > 0) end_row();
+    std::string buf(TABLE_MAGIC, sizeof(TABLE_MAGIC));
+    put_u64(buf, rows);
+    put_u64(buf, columns.size());
+    for (const auto& c : columns) {
+        put_u64(buf, c.name.size());
+        put_bytes(buf, c.name.data(), c.name.size());
+        put_u64(buf, c.numeric);
+        if (c.numeric) {
+            put_bytes(buf, c.numbers.data(), c.numbers.size() * sizeof(int64_t));
+        } else {
+            put_u64(buf, c.dict.size());
+            for (const auto& entry : c.dict) {
+                put_u64(buf, entry.size());
+                put_bytes(buf, entry.data(), entry.size());
+            }
+            put_bytes(buf, c.codes.data(), c.codes.size() * sizeof(uint32_t));
+        }
+        // columns are handed to the output one at a time, rather than copying the whole table
+        out->write(buf.data(), buf.size());
+        buf.clear();
+    }
+    out->close();
+}
+
+table_reader::table_reader(std::vector<char> data_in) : data(std::move(data_in)) {
+    parse(data.data(), data.size());
+}
+
+table_reader::table_reader(FILE* fp) {
+    struct stat st;
+    if (fstat(fileno(fp), &st) || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        fclose(fp);
+        throw std::runtime_error("tables can only be read from regular files");
+    }
+    file.reset(new mapped_file_t(fp, st.st_size));
+    parse(file->base, file->size);
+}
+
+bool table_reader::is_table(const char* data, size_t len) {
+    return len >= sizeof(TABLE_MAGIC) && !memcmp(data, TABLE_MAGIC, sizeof(TABLE_MAGIC));
+}
+
+bool table_reader::is_table(const std::string& path) {
+    char magic[sizeof(TABLE_MAGIC)];
+    FILE* fp = fopen(path.c_str(), "r");
+    if (!fp) return false;
+    size_t len = fread(magic, 1, sizeof(magic), fp);
+    fclose(fp);
+    return is_table(magic, len);
+}
+
+void table_reader::parse(const char* base, size_t size) {
+    size_t pos = sizeof(TABLE_MAGIC);
+    // every section starts at a multiple of 8 bytes, so integers can be read in place
+    auto take = [&](size_t len) -> const char* {
+        if (size - pos < len) throw std::runtime_error("truncated table");
+        const char* p = base + pos;
+        pos += (len + 7) & ~size_t(7);
+        if (pos > size) pos = size;
+        return p;
+    };
+    auto u64 = [&]() { return *(const uint64_t*)take(sizeof(uint64_t)); };
+    if (!is_table(base, size)) throw std::runtime_error("not a table");
+    nrows = u64();
+    uint64_t ncols = u64();
+    if (ncols > size) throw std::runtime_error("malformed table");
+    cols.resize(ncols);
+    for (auto& c : cols) {
+        uint64_t len = u64();
+        c.name.assign(take(len), len);
+        uint64_t kind = u64();
+        if (kind > 1) throw std::runtime_error("malformed table");
+        c.numeric = kind == 1;
+        if (c.numeric) {
+            if (nrows > size / sizeof(int64_t)) throw std::runtime_error("truncated table");
+            c.numbers = (const int64_t*)take(nrows * sizeof(int64_t));
+            continue;
+        }
+        uint64_t entries = u64();
+        if (entries > size) throw std::runtime_error("malformed table");
+        c.dict.resize(entries);
+        for (auto& entry : c.dict) {
+            len = u64();
+            entry.assign(take(len), len);
+        }
+        if (nrows > size / sizeof(uint32_t)) throw std::runtime_error("truncated table");
+        c.codes = (const uint32_t*)take(nrows * sizeof(uint32_t));
+        for (size_t i = 0; i < nrows; ++i) {
+            if (c.codes[i] >= entries) throw std::runtime_error("malformed table");
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef included_table_h_
+#define included_table_h_
+
+#include <unordered_map>
+
+#include "csv.h"
+
+/**
+ * Native columnar format for intermediate results, which are written by one csvman invocation
+ * only to be loaded by the next, so that neither has to format or parse them as text. A table
+ * holds the same header and cells as the equivalent CSV file, stored a column at a time. Columns
+ * in which every cell is a plain integer are stored as int64 values; all others are dictionary
+ * encoded, i.e. each distinct cell is stored once and rows refer to it by its uint32 code.
+ *
+ * Layout (native byte order; tables are meant to be read back on the machine that wrote them,
+ * every section starts at a multiple of 8 bytes):
+ *     magic "CMTABLE1", u64 rows, u64 columns, then for each column:
+ *     u64 name length, name, u64 kind (0 = dictionary, 1 = int64), then
+ *         for dictionary columns: u64 entries, each entry as u64 length and bytes, then u32 codes
+ *         for int64 columns: int64 values
+ */
+class table_writer: public row_writer {
+public:
+    table_writer(std::unique_ptr<output_t> out_in) : out(std::move(out_in)) {}
+    using row_writer::field;
+    void field(const char* s, size_t len) override;
+    void field(int64_t v) override;
+    void end_row() override;
+    // write out the table and close the output; throws on failure
+    void close() override;
+private:
+    struct column_t {
+        std::string name;
+        bool numeric{true};
+        std::vector<int64_t> numbers;
+        std::vector<uint32_t> codes;
+        std::vector<std::string> dict;
+        std::unordered_map<std::string, uint32_t> index;
+        uint32_t code(const char* s, size_t len);
+        // switch to a dictionary column, once a cell which is not a plain integer turns up
+        void demote();
+    };
+    std::unique_ptr<output_t> out;
+    std::vector<column_t> columns;
+    size_t column{0};
+    uint64_t rows{0};
+    bool header{true};
+    bool closed{false};
+    column_t& next_column();
+};
+
+/**
+ * Reader for a table written by a table_writer. The table is either memory mapped, or held in a
+ * buffer; either way, cells are handed out straight from it. Malformed tables throw on opening.
+ */
+class table_reader {
+public:
+    struct column_t {
+        std::string name;
+        bool numeric;
+        std::vector<std::string> dict;
+        const uint32_t* codes{nullptr};
+        const int64_t* numbers{nullptr};
+        // the cell in the given row as text
+        std::string text(size_t row) const { return numeric ? std::to_string(numbers[row]) : dict[codes[row]]; }
+    };
+    // read the table in data_in, taking ownership of it
+    table_reader(std::vector<char> data_in);
+    // map the table in the regular file fp, taking ownership of it
+    table_reader(FILE* fp);
+    size_t rows() const { return nrows; }
+    const std::vector<column_t>& columns() const { return cols; }
+    // whether the len bytes at data are the start of a table
+    static bool is_table(const char* data, size_t len);
+    // whether the file at path is a table
+    static bool is_table(const std::string& path);
+private:
+    std::vector<char> data;
+    std::unique_ptr<mapped_file_t> file;
+    size_t nrows{0};
+    std::vector<column_t> cols;
+    void parse(const char* base, size_t size);
+};
+
+#endif // included_table_h_
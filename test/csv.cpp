@@ -0,0 +1,81 @@
+#include "catch.hpp"
+#include "helpers.h"
+
+#include "../parser/csv.h"
+
+// rows with quoted commas, quotes and newlines, and every so often a quoted field long enough to
+// span chunks, so that some chunks start inside quotes
+static std::string quoted_csv(size_t size) {
+    std::string csv = "id,name,note,count\n";
+    for (size_t i = 0; csv.size() < size; ++i) {
+        const std::string n = std::to_string(i);
+        csv += n + ",\"name, " + n + "\",";
+        if (i % 20000 == 19999) {
+            csv += "\"" + std::string(3 * parallel_csv::CHUNK_SIZE / 2 + i % 7, 'x') + "\nlong\",";
+        } else if (i % 3 == 0) {
+            csv += "\"multi\nline \"\"" + n + "\"\"\",";
+        } else {
+            csv += "plain,";
+        }
+        csv += std::to_string(i * 7) + "\n";
+    }
+    // and a last row without a newline
+    return csv + "last,\"row\",,0";
+}
+
+static std::vector<std::vector<std::string>> read_all(csv_reader& reader) {
+    std::vector<std::vector<std::string>> rows;
+    csv_row_t row;
+    while (reader.read(row)) {
+        rows.emplace_back();
+        for (const auto& field : row) rows.back().push_back(field.str());
+    }
+    return rows;
+}
+
+TEST_CASE("Parallel CSV reader hands out the rows of the serial reader", "[csv]") {
+    scratch_dir_t dir;
+    const std::string path = dir / "quoted.csv";
+    const std::string csv = quoted_csv(5 * parallel_csv::CHUNK_SIZE / 2 + 12345);
+    write_file(path, csv);
+
+    buffer_csv serial(std::vector<char>(csv.begin(), csv.end()));
+    const auto expected = read_all(serial);
+    REQUIRE(expected.size() > 1000);
+
+    for (size_t threads : { 2, 3, 8 }) {
+        INFO(threads << " threads");
+        parallel_csv parallel(fopen(path.c_str(), "rb"), csv.size(), threads);
+        const auto rows = read_all(parallel);
+        REQUIRE(rows.size() == expected.size());
+        for (size_t i = 0; i < rows.size(); ++i) {
+            INFO("row " << i);
+            REQUIRE(rows[i] == expected[i]);
+        }
+    }
+}
+
+TEST_CASE("Parallel CSV reader hands out the projected columns of the serial reader", "[csv]") {
+    scratch_dir_t dir;
+    const std::string path = dir / "quoted.csv";
+    const std::string csv = quoted_csv(3 * parallel_csv::CHUNK_SIZE);
+    write_file(path, csv);
+    const std::vector<bool> needed = { true, false, true };
+
+    buffer_csv serial(std::vector<char>(csv.begin(), csv.end()));
+    serial.project(needed);
+    const auto expected = read_all(serial);
+
+    parallel_csv parallel(fopen(path.c_str(), "rb"), csv.size(), 4);
+    parallel.project(needed);
+    const auto rows = read_all(parallel);
+    REQUIRE(rows.size() == expected.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        INFO("row " << i);
+        // readers may apply the projection from some row onwards only, but the needed columns are
+        // always there
+        REQUIRE(rows[i].size() >= 3);
+        CHECK(rows[i][0] == expected[i][0]);
+        CHECK(rows[i][2] == expected[i][2]);
+    }
+}
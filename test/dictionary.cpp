@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include "catch.hpp"
+
+#include "../dictionary.h"
+
+// the sign of the order of a and b
+static int order(const std::string& a, const std::string& b) {
+    return val_t(a) < val_t(b) ? -1 : val_t(b) < val_t(a) ? 1 : 0;
+}
+
+static int sign(int v) { return (v > 0) - (v < 0); }
+
+TEST_CASE("Codes of a key dictionary compare like their values", "[dictionary]") {
+    key_dictionary_t dictionary;
+    const std::vector<std::string> values = { "Burma", "Afghanistan", "Zimbabwe", "Chad", "Afghanistan", "42", "7", "", "Bhutan" };
+    std::vector<uint32_t> codes;
+    for (const auto& v : values) codes.push_back(dictionary.encode(val_t(v)));
+
+    // the same value always gets the same code
+    CHECK(codes[1] == codes[4]);
+    CHECK(dictionary.encode(val_t("Chad")) == codes[3]);
+    for (size_t i = 0; i < values.size(); ++i) {
+        for (size_t j = 0; j < values.size(); ++j) {
+            INFO(values[i] << " vs " << values[j]);
+            CHECK(sign(dictionary.compare(codes[i], codes[j])) == order(values[i], values[j]));
+        }
+    }
+}
+
+TEST_CASE("Key dictionaries rank values anew once there is no room left between neighbors", "[dictionary]") {
+    key_dictionary_t dictionary;
+    std::vector<std::string> values = { "a", "b" };
+    // each is ranked between "a" and the one before it, halving the room left every time
+    for (size_t i = 1; i <= 200; ++i) values.push_back(std::string(i, 'a') + "b");
+    std::vector<uint32_t> codes;
+    for (const auto& v : values) codes.push_back(dictionary.encode(val_t(v)));
+
+    for (size_t i = 0; i < values.size(); ++i) {
+        // codes never change, even as the values are ranked anew
+        REQUIRE(dictionary.encode(val_t(values[i])) == codes[i]);
+        for (size_t j = 0; j < values.size(); ++j) {
+            INFO(values[i] << " vs " << values[j]);
+            REQUIRE(sign(dictionary.compare(codes[i], codes[j])) == order(values[i], values[j]));
+        }
+    }
+}
+
+TEST_CASE("Key dictionaries are compared on some threads while being added to on others", "[dictionary]") {
+    key_dictionary_t dictionary;
+    // two values which stay put while others are squeezed in between them, ranking them anew
+    const uint32_t lo = dictionary.encode(val_t("a"));
+    const uint32_t hi = dictionary.encode(val_t("b"));
+    std::atomic<bool> done{false};
+    std::atomic<size_t> wrong{0};
+
+    std::vector<std::thread> readers;
+    for (size_t t = 0; t < 3; ++t) {
+        readers.emplace_back([&] {
+            while (!done.load()) {
+                if (dictionary.compare(lo, hi) >= 0 || dictionary.compare(hi, lo) <= 0) ++wrong;
+            }
+        });
+    }
+    std::vector<std::thread> writers;
+    for (size_t t = 0; t < 2; ++t) {
+        writers.emplace_back([&, t] {
+            for (size_t i = 1; i <= 1000; ++i) {
+                const std::string v = std::string(i, 'a') + char('b' + t);
+                const uint32_t code = dictionary.encode(val_t(v));
+                if (dictionary.compare(lo, code) >= 0 || dictionary.compare(code, hi) >= 0) ++wrong;
+            }
+        });
+    }
+    for (auto& th : writers) th.join();
+    done = true;
+    for (auto& th : readers) th.join();
+    CHECK(wrong == 0);
+}
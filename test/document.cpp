@@ -0,0 +1,41 @@
+#include "catch.hpp"
+#include "helpers.h"
+
+#include "../document.h"
+
+// the value of name in the entry whose keys include key
+static int64_t number_at(const document_t& doc, const std::string& key, const std::string& name) {
+    for (const auto& entry : doc.data) {
+        bool match = false;
+        for (const auto& v : entry.first.values()) match |= v->get_value() == key;
+        if (!match) continue;
+        const val_t* value = entry.second.get(entry.second.schema->find(name));
+        REQUIRE(value);
+        return value->get_number();
+    }
+    FAIL("no entry for " << key);
+    return 0;
+}
+
+TEST_CASE("Each file of a directory replaces the sums of the files before it", "[document]") {
+    scratch_dir_t dir;
+    write_file(dir / "gds.cmf", GDS_CMF);
+    // the phase of each file must stay distinct well beyond 8 bits
+    for (size_t files : { 255, 256, 257, 300 }) {
+        const std::string path = dir.mkdir("days" + std::to_string(files));
+        for (size_t i = 0; i < files; ++i) {
+            const char* row = i == 0 ? "2020-01-22,Afghanistan,,10,1\n" : i + 1 == files ? "2020-01-22,Afghanistan,,7,2\n" : "2020-01-22,Burma,,1,0\n";
+            char name[16];
+            snprintf(name, sizeof(name), "%05zu.csv", i);
+            write_file(path + "/" + name, std::string(GDS_HEADER) + row);
+        }
+        for (size_t jobs : { 1, 4 }) {
+            document_t doc((dir / "gds.cmf").c_str());
+            doc.jobs = jobs;
+            doc.load_from_disk(std::vector<std::string>{ path });
+            INFO(files << " files, " << jobs << " jobs");
+            CHECK(number_at(doc, "Afghanistan", "confirmed") == 7);
+            CHECK(number_at(doc, "Afghanistan", "deaths") == 2);
+        }
+    }
+}
@@ -0,0 +1,85 @@
+#ifndef included_test_helpers_h_
+#define included_test_helpers_h_
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <ftw.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// a temporary directory, removed along with everything in it when done
+struct scratch_dir_t {
+    std::string path;
+    scratch_dir_t() {
+        char tmpl[] = "/tmp/csvman-test-XXXXXX";
+        if (!mkdtemp(tmpl)) throw std::runtime_error("mkdtemp failed");
+        path = tmpl;
+    }
+    ~scratch_dir_t() {
+        nftw(path.c_str(), [](const char* p, const struct stat*, int, struct FTW*) { return remove(p); }, 16, FTW_DEPTH | FTW_PHYS);
+    }
+    std::string operator/(const std::string& name) const { return path + "/" + name; }
+    std::string mkdir(const std::string& name) const {
+        const std::string p = *this / name;
+        ::mkdir(p.c_str(), 0700);
+        return p;
+    }
+};
+
+inline void write_file(const std::string& path, const std::string& content) {
+    std::ofstream out(path, std::ios::binary);
+    out << content;
+}
+
+inline void append_file(const std::string& path, const std::string& content) {
+    std::ofstream out(path, std::ios::binary | std::ios::app);
+    out << content;
+}
+
+inline std::string read_file(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// redirects stdout to a file for as long as it lives, e.g. to check the reports of a document
+struct stdout_capture_t {
+    std::string path;
+    int saved;
+    stdout_capture_t(const std::string& path_in) : path(path_in) {
+        fflush(stdout);
+        saved = dup(1);
+        int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        dup2(fd, 1);
+        close(fd);
+    }
+    ~stdout_capture_t() { restore(); }
+    // stop capturing, and get what was printed
+    std::string restore() {
+        if (saved >= 0) {
+            fflush(stdout);
+            dup2(saved, 1);
+            close(saved);
+            saved = -1;
+        }
+        return read_file(path);
+    }
+};
+
+// a format with a date and a place as keys, and summed counts, like that of the GDS data set
+static const char* const GDS_CMF =
+    "key date = \"Date\" as { \"%u-%u-%u\", year(0), month(1), day(2) };\n"
+    "state = \"Country/Region\";\n"
+    "region = \"Province/State\";\n"
+    "key place = fit region, state;\n"
+    "confirmed = sum(\"Confirmed\");\n"
+    "deaths = sum(\"Deaths\");\n";
+
+static const char* const GDS_HEADER = "Date,Country/Region,Province/State,Confirmed,Deaths\n";
+
+#endif // included_test_helpers_h_
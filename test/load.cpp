@@ -0,0 +1,63 @@
+#include "catch.hpp"
+#include "helpers.h"
+
+#include "../document.h"
+
+// the places are named by country in some inputs, and by province in others, so which version of
+// each fit is taken depends on the inputs loaded before
+static const char* const INPUTS[] = {
+    "2020-01-22,China,Hubei,444,17\n"
+    "2020-01-22,Afghanistan,,10,1\n"
+    "2020-01-23,China,Hubei,444,18\n",
+
+    "2020-01-22,Hubei,,3,0\n"
+    "2020-01-22,Afghanistan,Kabul,1,0\n"
+    "2020-01-23,Hubei,China,5,1\n"
+    "2020-01-23,Burma,,2,0\n",
+
+    "2020-01-23,Afghanistan,,12,1\n"
+    "2020-01-23,Kabul,,3,0\n"
+    "2020-01-23,China,Beijing,14,0\n"
+    "2020-01-24,Beijing,China,15,0\n",
+};
+
+// load the inputs into documents sharing a fitness set, using jobs threads, and write each out;
+// returns the outputs and the fitness set
+static std::vector<std::string> load(const scratch_dir_t& dir, size_t jobs) {
+    std::set<std::string> fitness_set;
+    std::vector<Document> documents;
+    std::vector<std::vector<std::string>> paths;
+    for (size_t i = 0; i < sizeof(INPUTS) / sizeof(INPUTS[0]); ++i) {
+        documents.push_back(std::make_shared<document_t>((dir / "gds.cmf").c_str(), &fitness_set));
+        documents.back()->jobs = jobs;
+        paths.push_back({ dir / ("input" + std::to_string(i) + ".csv") });
+    }
+    document_t::load_from_disk(documents, paths);
+    std::vector<std::string> outputs;
+    for (size_t i = 0; i < documents.size(); ++i) {
+        const std::string out = dir / ("output" + std::to_string(i) + ".csv");
+        documents[i]->save_data_to_disk(out);
+        outputs.push_back(read_file(out));
+    }
+    std::string fitness;
+    for (const auto& f : fitness_set) fitness += f + "\n";
+    outputs.push_back(fitness);
+    return outputs;
+}
+
+TEST_CASE("Documents loaded concurrently are those loaded one after the other", "[load]") {
+    scratch_dir_t dir;
+    write_file(dir / "gds.cmf", GDS_CMF);
+    for (size_t i = 0; i < sizeof(INPUTS) / sizeof(INPUTS[0]); ++i) {
+        write_file(dir / ("input" + std::to_string(i) + ".csv"), std::string(GDS_HEADER) + INPUTS[i]);
+    }
+    const auto expected = load(dir, 1);
+    REQUIRE(expected.back().size() > 0);
+    // the threads finish in a different order each time
+    for (size_t round = 0; round < 20; ++round) {
+        for (size_t jobs : { 2, 4 }) {
+            INFO(jobs << " jobs, round " << round);
+            REQUIRE(load(dir, jobs) == expected);
+        }
+    }
+}
@@ -0,0 +1,9 @@
+// Unit tests.
+//
+// Compile and run from the repository root:
+//   g++ -O2 -std=c++11 -pthread test/*.cpp parser/*.cpp $(ls *.cpp | grep -v compile.cpp) -lz -o test_csvman && ./test_csvman
+
+#define CATCH_CONFIG_MAIN
+// the alternate signal stack of this version of Catch does not build against newer glibc
+#define CATCH_CONFIG_NO_POSIX_SIGNALS
+#include "catch.hpp"
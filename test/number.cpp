@@ -0,0 +1,51 @@
+#include <cstring>
+
+#include "catch.hpp"
+
+#include "../parser/number.h"
+
+static bool parse(const char* s, int64_t& v) { return number::parse(s, strlen(s), v); }
+
+TEST_CASE("Numeric cells are converted to their integer part", "[number]") {
+    int64_t v = -1;
+    CHECK(parse("0", v));
+    CHECK(v == 0);
+    CHECK(parse("42", v));
+    CHECK(v == 42);
+    CHECK(parse("007", v));
+    CHECK(v == 7);
+    CHECK(parse("33.94", v));
+    CHECK(v == 33);
+    CHECK(parse("5.", v));
+    CHECK(v == 5);
+    CHECK(parse(".5", v));
+    CHECK(v == 0);
+    CHECK(parse("9223372036854775807", v));
+    CHECK(v == INT64_MAX);
+    // the decimals are not converted, so they may be as long as they like
+    CHECK(parse("1.99999999999999999999999999", v));
+    CHECK(v == 1);
+    // only the first len bytes are looked at
+    CHECK(number::parse("123abc", 3, v));
+    CHECK(v == 123);
+}
+
+TEST_CASE("Cells which are not numeric leave the number untouched", "[number]") {
+    for (const char* s : { "", "-1", "+1", " 1", "1 ", "1e5", "1,000", "1.2.3", "0x10", "abc", "-" }) {
+        int64_t v = 77;
+        INFO("'" << s << "'");
+        CHECK_FALSE(parse(s, v));
+        CHECK(v == 77);
+    }
+}
+
+TEST_CASE("Integer parts which do not fit in 64 bits are not numeric", "[number]") {
+    int64_t v = 77;
+    CHECK_FALSE(parse("9223372036854775808", v));
+    CHECK_FALSE(parse("18446744073709551616", v));
+    CHECK_FALSE(parse("99999999999999999999999", v));
+    CHECK_FALSE(parse("9223372036854775808.5", v));
+    CHECK(v == 77);
+    CHECK(parse("0009223372036854775807.9", v));
+    CHECK(v == INT64_MAX);
+}
@@ -0,0 +1,75 @@
+#include "catch.hpp"
+#include "helpers.h"
+
+#include "../document.h"
+
+static const char* const DAY_1 =
+    "2020-01-22,Afghanistan,,10,1\n"
+    "2020-01-22,China,Hubei,444,17\n"
+    "2020-01-22,China,Beijing,14,0\n"
+    "2020-01-22,Hubei,,3,0\n";
+static const char* const DAY_2 =
+    "2020-01-23,Afghanistan,,12,1\n"
+    "2020-01-23,China,Hubei,444,18\n"
+    "2020-01-23,China,Hubei,5,1\n"
+    "2020-01-23,\"Korea, South\",,1,0\n";
+static const char* const DAY_3 =
+    "2020-01-24,China,Hubei,549,24\n"
+    "2020-01-24,Burma,,2,0\n";
+
+// load path into a document of dir's gds.cmf, caching it in cache if set, and write it out as a
+// CSV file; returns what the document printed
+static std::string load(const scratch_dir_t& dir, const std::string& path, const std::string& cache, const std::string& out) {
+    stdout_capture_t printed(dir / "stdout.txt");
+    document_t doc((dir / "gds.cmf").c_str());
+    doc.cache_dir = cache;
+    doc.load_from_disk(std::vector<std::string>{ path });
+    doc.save_data_to_disk(out);
+    return printed.restore();
+}
+
+TEST_CASE("Documents restored from a snapshot are those that were loaded", "[snapshot]") {
+    scratch_dir_t dir;
+    write_file(dir / "gds.cmf", GDS_CMF);
+    // a directory, so that the input is keyed on its files rather than loaded as a tail
+    const std::string days = dir.mkdir("days");
+    write_file(days + "/1.csv", std::string(GDS_HEADER) + DAY_1);
+    write_file(days + "/2.csv", std::string(GDS_HEADER) + DAY_2);
+    const std::string cache = dir.mkdir("cache");
+
+    CHECK(load(dir, days, cache, dir / "loaded.csv").find("Restored") == std::string::npos);
+    CHECK(load(dir, days, cache, dir / "restored.csv").find("Restored") != std::string::npos);
+    CHECK(read_file(dir / "restored.csv") == read_file(dir / "loaded.csv"));
+
+    // changed inputs are loaded anew
+    write_file(days + "/3.csv", std::string(GDS_HEADER) + DAY_3);
+    CHECK(load(dir, days, cache, dir / "changed.csv").find("Restored") == std::string::npos);
+    load(dir, days, "", dir / "uncached.csv");
+    CHECK(read_file(dir / "changed.csv") == read_file(dir / "uncached.csv"));
+}
+
+TEST_CASE("Rows appended to an input are loaded on top of its snapshot", "[snapshot]") {
+    scratch_dir_t dir;
+    write_file(dir / "gds.cmf", GDS_CMF);
+    const std::string path = dir / "gds.csv";
+    const std::string cache = dir.mkdir("cache");
+    write_file(path, std::string(GDS_HEADER) + DAY_1);
+    load(dir, path, cache, dir / "cached.csv");
+
+    // appended rows add to the sums of the day before as well as to new days, and the snapshot
+    // is taken anew each time, so that rows appended later still go on top
+    for (const char* day : { DAY_2, DAY_3 }) {
+        append_file(path, day);
+        const std::string printed = load(dir, path, cache, dir / "cached.csv");
+        CHECK(printed.find("Restored") != std::string::npos);
+        CHECK(printed.find("appended lines") != std::string::npos);
+        load(dir, path, "", dir / "uncached.csv");
+        CHECK(read_file(dir / "cached.csv") == read_file(dir / "uncached.csv"));
+    }
+
+    // anything but appending loads the file anew
+    write_file(path, std::string(GDS_HEADER) + DAY_3 + DAY_1);
+    CHECK(load(dir, path, cache, dir / "cached.csv").find("Restored") == std::string::npos);
+    load(dir, path, "", dir / "uncached.csv");
+    CHECK(read_file(dir / "cached.csv") == read_file(dir / "uncached.csv"));
+}
@@ -0,0 +1,95 @@
+#include <algorithm>
+
+#include "catch.hpp"
+#include "helpers.h"
+
+#include "../document.h"
+#include "../parser/table.h"
+
+TEST_CASE("Tables hold the cells they were written", "[table]") {
+    scratch_dir_t dir;
+    const std::string path = dir / "cells.cmb";
+    const std::vector<std::vector<std::string>> rows = {
+        { "negative", "number", "mixed", "text" },
+        { "-5", "1", "42", "Afghanistan" },
+        { "0", "20", "007", "Burma, Union of" },
+        { "9223372036854775", "300", "", "" },
+        { "-1", "0", "12", "Afghanistan" },
+    };
+    {
+        std::unique_ptr<row_writer> writer = row_writer::open(fopen(path.c_str(), "wb"), path);
+        for (const auto& row : rows) writer->write(row);
+        // a short row is padded with empty cells
+        writer->field(int64_t(-4000));
+        writer->field(int64_t(4000));
+        writer->end_row();
+        writer->close();
+    }
+    REQUIRE(table_reader::is_table(path));
+
+    table_reader table(fopen(path.c_str(), "rb"));
+    const auto& columns = table.columns();
+    REQUIRE(columns.size() == 4);
+    REQUIRE(table.rows() == rows.size());
+    CHECK(columns[0].numeric);
+    CHECK(columns[1].numeric);
+    // "007" and "" would not come back from a number
+    CHECK_FALSE(columns[2].numeric);
+    CHECK_FALSE(columns[3].numeric);
+    for (size_t c = 0; c < columns.size(); ++c) {
+        CHECK(columns[c].name == rows[0][c]);
+        for (size_t r = 1; r < rows.size(); ++r) CHECK(columns[c].text(r - 1) == rows[r][c]);
+    }
+    CHECK(columns[0].text(4) == "-4000");
+    CHECK(columns[1].text(4) == "4000");
+    CHECK(columns[2].text(4) == "");
+    CHECK(columns[3].text(4) == "");
+}
+
+// the values of the documents, entry by entry, as text and whether they are numeric
+static std::vector<std::string> values_of(const document_t& doc) {
+    std::vector<std::string> values;
+    for (const auto& entry : doc.data) {
+        for (const auto& v : entry.first.values()) values.push_back(v->get_value());
+        for (const char* name : { "confirmed", "deaths" }) {
+            const val_t* v = entry.second.get(entry.second.schema->find(name));
+            values.push_back(v ? std::string(v->is_number() ? "#" : "") + v->get_value() : "-");
+        }
+    }
+    return values;
+}
+
+TEST_CASE("Documents load the same from a table as from the CSV file it was written from", "[table]") {
+    scratch_dir_t dir;
+    // plain values rather than sums, which would turn every cell into a number
+    write_file(dir / "counts.cmf",
+        "key date = \"Date\" as { \"%u-%u-%u\", year(0), month(1), day(2) };\n"
+        "state = \"Country/Region\";\n"
+        "region = \"Province/State\";\n"
+        "key place = fit region, state;\n"
+        "confirmed = \"Confirmed\";\n"
+        "deaths = \"Deaths\";\n");
+    // deaths are corrected downwards on one day; negative cells are text, not numbers
+    write_file(dir / "gds.csv", std::string(GDS_HEADER) +
+        "2020-01-22,Afghanistan,,10,1\n"
+        "2020-01-22,China,Hubei,444,17\n"
+        "2020-01-22,China,Beijing,14,0\n"
+        "2020-01-23,Afghanistan,,12,-3\n"
+        "2020-01-23,China,Hubei,444,18\n"
+        "2020-01-23,\"Korea, South\",,1,0\n"
+        "2020-01-24,China,Hubei,549,24\n");
+
+    document_t from_csv((dir / "counts.cmf").c_str());
+    from_csv.load_from_disk(std::vector<std::string>{ dir / "gds.csv" });
+    from_csv.save_data_to_disk(dir / "from_csv.csv");
+    from_csv.save_data_to_disk(dir / "gds.cmb");
+    REQUIRE(table_reader::is_table(dir / "gds.cmb"));
+
+    document_t from_table((dir / "counts.cmf").c_str());
+    from_table.load_from_disk(std::vector<std::string>{ dir / "gds.cmb" });
+    from_table.save_data_to_disk(dir / "from_table.csv");
+    const auto expected = values_of(from_csv);
+    CHECK(std::find(expected.begin(), expected.end(), "-3") != expected.end());
+    CHECK(values_of(from_table) == expected);
+    CHECK(read_file(dir / "from_table.csv") == read_file(dir / "from_csv.csv"));
+}